@@ -0,0 +1,999 @@
+/* benchmark.c: xargparse against glibc's getopt_long
+ *
+ *     make bench    (or gcc -O2 benchmark.c -o benchmark && ./benchmark)
+ *
+ * runs every suite; ./benchmark parsers scaling ... runs only those named.
+ *
+ * parsers: the option sets are built from a catalog of 95 short options (every
+ * printable character, each with a long form, half of them flags) and 256
+ * long-only options: the first 1, 8, 26, 62, 93 and 95 short options, and
+ * the first 93 together with all of the long-only ones. Each set is parsed
+ * by the macro parser, the table parser and getopt_long with the same
+ * converters, except that getopt_long cannot take ':' or ';' as options and
+ * sits out the 95 set. Each workload shape is parsed many times from a
+ * fresh copy of its argv. The fields and the leftovers must come out the
+ * same, or the program says where they differ and fails. Every option
+ * appears at most once per command line, since getopt_long does not reject
+ * repeats. malloc and friends are wrapped to count the allocations made
+ * while parsing.
+ *
+ * scaling: a repeated option and its value between positionals, from 10 to
+ * 1,000,000 arguments, to show that the time per argument stays flat.
+ *
+ * converters: xap_int32, xap_int64 and xap_float64 against xap_int, xap_long
+ * and xap_double, which go through strtol and strtod, in ns per conversion.
+ *
+ * batch: xap_parse_batch() throughput on 1 up to as many threads as there
+ * are online CPUs, or as BENCH_THREADS says.
+ */
+#define _GNU_SOURCE
+#include "xargparse.h"
+#include <getopt.h>
+#include <time.h>
+#include <sys/resource.h>
+
+/* the catalog, in the order the sets take from it */
+#define shorts_1(_) \
+	_( 'a'  , "opt-97"  , int , o_97 , , xap_int   ) \
+
+#define shorts_2_8(_) \
+	_( 'b'  , "opt-98"  , bool, o_98 , , xap_toggle) \
+	_( 'c'  , "opt-99"  , int , o_99 , , xap_int   ) \
+	_( 'd'  , "opt-100" , bool, o_100, , xap_toggle) \
+	_( 'e'  , "opt-101" , int , o_101, , xap_int   ) \
+	_( 'f'  , "opt-102" , bool, o_102, , xap_toggle) \
+	_( 'g'  , "opt-103" , int , o_103, , xap_int   ) \
+	_( 'h'  , "opt-104" , bool, o_104, , xap_toggle) \
+
+#define shorts_9_26(_) \
+	_( 'i'  , "opt-105" , int , o_105, , xap_int   ) \
+	_( 'j'  , "opt-106" , bool, o_106, , xap_toggle) \
+	_( 'k'  , "opt-107" , int , o_107, , xap_int   ) \
+	_( 'l'  , "opt-108" , bool, o_108, , xap_toggle) \
+	_( 'm'  , "opt-109" , int , o_109, , xap_int   ) \
+	_( 'n'  , "opt-110" , bool, o_110, , xap_toggle) \
+	_( 'o'  , "opt-111" , int , o_111, , xap_int   ) \
+	_( 'p'  , "opt-112" , bool, o_112, , xap_toggle) \
+	_( 'q'  , "opt-113" , int , o_113, , xap_int   ) \
+	_( 'r'  , "opt-114" , bool, o_114, , xap_toggle) \
+	_( 's'  , "opt-115" , int , o_115, , xap_int   ) \
+	_( 't'  , "opt-116" , bool, o_116, , xap_toggle) \
+	_( 'u'  , "opt-117" , int , o_117, , xap_int   ) \
+	_( 'v'  , "opt-118" , bool, o_118, , xap_toggle) \
+	_( 'w'  , "opt-119" , int , o_119, , xap_int   ) \
+	_( 'x'  , "opt-120" , bool, o_120, , xap_toggle) \
+	_( 'y'  , "opt-121" , int , o_121, , xap_int   ) \
+	_( 'z'  , "opt-122" , bool, o_122, , xap_toggle) \
+
+#define shorts_27_62(_) \
+	_( 'A'  , "opt-65"  , int , o_65 , , xap_int   ) \
+	_( 'B'  , "opt-66"  , bool, o_66 , , xap_toggle) \
+	_( 'C'  , "opt-67"  , int , o_67 , , xap_int   ) \
+	_( 'D'  , "opt-68"  , bool, o_68 , , xap_toggle) \
+	_( 'E'  , "opt-69"  , int , o_69 , , xap_int   ) \
+	_( 'F'  , "opt-70"  , bool, o_70 , , xap_toggle) \
+	_( 'G'  , "opt-71"  , int , o_71 , , xap_int   ) \
+	_( 'H'  , "opt-72"  , bool, o_72 , , xap_toggle) \
+	_( 'I'  , "opt-73"  , int , o_73 , , xap_int   ) \
+	_( 'J'  , "opt-74"  , bool, o_74 , , xap_toggle) \
+	_( 'K'  , "opt-75"  , int , o_75 , , xap_int   ) \
+	_( 'L'  , "opt-76"  , bool, o_76 , , xap_toggle) \
+	_( 'M'  , "opt-77"  , int , o_77 , , xap_int   ) \
+	_( 'N'  , "opt-78"  , bool, o_78 , , xap_toggle) \
+	_( 'O'  , "opt-79"  , int , o_79 , , xap_int   ) \
+	_( 'P'  , "opt-80"  , bool, o_80 , , xap_toggle) \
+	_( 'Q'  , "opt-81"  , int , o_81 , , xap_int   ) \
+	_( 'R'  , "opt-82"  , bool, o_82 , , xap_toggle) \
+	_( 'S'  , "opt-83"  , int , o_83 , , xap_int   ) \
+	_( 'T'  , "opt-84"  , bool, o_84 , , xap_toggle) \
+	_( 'U'  , "opt-85"  , int , o_85 , , xap_int   ) \
+	_( 'V'  , "opt-86"  , bool, o_86 , , xap_toggle) \
+	_( 'W'  , "opt-87"  , int , o_87 , , xap_int   ) \
+	_( 'X'  , "opt-88"  , bool, o_88 , , xap_toggle) \
+	_( 'Y'  , "opt-89"  , int , o_89 , , xap_int   ) \
+	_( 'Z'  , "opt-90"  , bool, o_90 , , xap_toggle) \
+	_( '0'  , "opt-48"  , int , o_48 , , xap_int   ) \
+	_( '1'  , "opt-49"  , bool, o_49 , , xap_toggle) \
+	_( '2'  , "opt-50"  , int , o_50 , , xap_int   ) \
+	_( '3'  , "opt-51"  , bool, o_51 , , xap_toggle) \
+	_( '4'  , "opt-52"  , int , o_52 , , xap_int   ) \
+	_( '5'  , "opt-53"  , bool, o_53 , , xap_toggle) \
+	_( '6'  , "opt-54"  , int , o_54 , , xap_int   ) \
+	_( '7'  , "opt-55"  , bool, o_55 , , xap_toggle) \
+	_( '8'  , "opt-56"  , int , o_56 , , xap_int   ) \
+	_( '9'  , "opt-57"  , bool, o_57 , , xap_toggle) \
+
+#define shorts_63_93(_) \
+	_( ' '  , "opt-32"  , int , o_32 , , xap_int   ) \
+	_( '!'  , "opt-33"  , bool, o_33 , , xap_toggle) \
+	_( '"'  , "opt-34"  , int , o_34 , , xap_int   ) \
+	_( '#'  , "opt-35"  , bool, o_35 , , xap_toggle) \
+	_( '$'  , "opt-36"  , int , o_36 , , xap_int   ) \
+	_( '%'  , "opt-37"  , bool, o_37 , , xap_toggle) \
+	_( '&'  , "opt-38"  , int , o_38 , , xap_int   ) \
+	_( '\'' , "opt-39"  , bool, o_39 , , xap_toggle) \
+	_( '('  , "opt-40"  , int , o_40 , , xap_int   ) \
+	_( ')'  , "opt-41"  , bool, o_41 , , xap_toggle) \
+	_( '*'  , "opt-42"  , int , o_42 , , xap_int   ) \
+	_( '+'  , "opt-43"  , bool, o_43 , , xap_toggle) \
+	_( ','  , "opt-44"  , int , o_44 , , xap_int   ) \
+	_( '-'  , "opt-45"  , bool, o_45 , , xap_toggle) \
+	_( '.'  , "opt-46"  , int , o_46 , , xap_int   ) \
+	_( '/'  , "opt-47"  , bool, o_47 , , xap_toggle) \
+	_( '<'  , "opt-60"  , int , o_60 , , xap_int   ) \
+	_( '='  , "opt-61"  , bool, o_61 , , xap_toggle) \
+	_( '>'  , "opt-62"  , int , o_62 , , xap_int   ) \
+	_( '?'  , "opt-63"  , bool, o_63 , , xap_toggle) \
+	_( '@'  , "opt-64"  , int , o_64 , , xap_int   ) \
+	_( '['  , "opt-91"  , bool, o_91 , , xap_toggle) \
+	_( '\\' , "opt-92"  , int , o_92 , , xap_int   ) \
+	_( ']'  , "opt-93"  , bool, o_93 , , xap_toggle) \
+	_( '^'  , "opt-94"  , int , o_94 , , xap_int   ) \
+	_( '_'  , "opt-95"  , bool, o_95 , , xap_toggle) \
+	_( '`'  , "opt-96"  , int , o_96 , , xap_int   ) \
+	_( '{'  , "opt-123" , bool, o_123, , xap_toggle) \
+	_( '|'  , "opt-124" , int , o_124, , xap_int   ) \
+	_( '}'  , "opt-125" , bool, o_125, , xap_toggle) \
+	_( '~'  , "opt-126" , int , o_126, , xap_int   ) \
+
+#define shorts_94_95(_) \
+	_( ':'  , "opt-58"  , bool, o_58 , , xap_toggle) \
+	_( ';'  , "opt-59"  , int , o_59 , , xap_int   ) \
+
+#define longs_1_64(_) \
+	_(XAP_LONG_ONLY +   0, "long-0"   , int, l_0  , , xap_int) \
+	_(XAP_LONG_ONLY +   1, "long-1"   , int, l_1  , , xap_int) \
+	_(XAP_LONG_ONLY +   2, "long-2"   , int, l_2  , , xap_int) \
+	_(XAP_LONG_ONLY +   3, "long-3"   , int, l_3  , , xap_int) \
+	_(XAP_LONG_ONLY +   4, "long-4"   , int, l_4  , , xap_int) \
+	_(XAP_LONG_ONLY +   5, "long-5"   , int, l_5  , , xap_int) \
+	_(XAP_LONG_ONLY +   6, "long-6"   , int, l_6  , , xap_int) \
+	_(XAP_LONG_ONLY +   7, "long-7"   , int, l_7  , , xap_int) \
+	_(XAP_LONG_ONLY +   8, "long-8"   , int, l_8  , , xap_int) \
+	_(XAP_LONG_ONLY +   9, "long-9"   , int, l_9  , , xap_int) \
+	_(XAP_LONG_ONLY +  10, "long-10"  , int, l_10 , , xap_int) \
+	_(XAP_LONG_ONLY +  11, "long-11"  , int, l_11 , , xap_int) \
+	_(XAP_LONG_ONLY +  12, "long-12"  , int, l_12 , , xap_int) \
+	_(XAP_LONG_ONLY +  13, "long-13"  , int, l_13 , , xap_int) \
+	_(XAP_LONG_ONLY +  14, "long-14"  , int, l_14 , , xap_int) \
+	_(XAP_LONG_ONLY +  15, "long-15"  , int, l_15 , , xap_int) \
+	_(XAP_LONG_ONLY +  16, "long-16"  , int, l_16 , , xap_int) \
+	_(XAP_LONG_ONLY +  17, "long-17"  , int, l_17 , , xap_int) \
+	_(XAP_LONG_ONLY +  18, "long-18"  , int, l_18 , , xap_int) \
+	_(XAP_LONG_ONLY +  19, "long-19"  , int, l_19 , , xap_int) \
+	_(XAP_LONG_ONLY +  20, "long-20"  , int, l_20 , , xap_int) \
+	_(XAP_LONG_ONLY +  21, "long-21"  , int, l_21 , , xap_int) \
+	_(XAP_LONG_ONLY +  22, "long-22"  , int, l_22 , , xap_int) \
+	_(XAP_LONG_ONLY +  23, "long-23"  , int, l_23 , , xap_int) \
+	_(XAP_LONG_ONLY +  24, "long-24"  , int, l_24 , , xap_int) \
+	_(XAP_LONG_ONLY +  25, "long-25"  , int, l_25 , , xap_int) \
+	_(XAP_LONG_ONLY +  26, "long-26"  , int, l_26 , , xap_int) \
+	_(XAP_LONG_ONLY +  27, "long-27"  , int, l_27 , , xap_int) \
+	_(XAP_LONG_ONLY +  28, "long-28"  , int, l_28 , , xap_int) \
+	_(XAP_LONG_ONLY +  29, "long-29"  , int, l_29 , , xap_int) \
+	_(XAP_LONG_ONLY +  30, "long-30"  , int, l_30 , , xap_int) \
+	_(XAP_LONG_ONLY +  31, "long-31"  , int, l_31 , , xap_int) \
+	_(XAP_LONG_ONLY +  32, "long-32"  , int, l_32 , , xap_int) \
+	_(XAP_LONG_ONLY +  33, "long-33"  , int, l_33 , , xap_int) \
+	_(XAP_LONG_ONLY +  34, "long-34"  , int, l_34 , , xap_int) \
+	_(XAP_LONG_ONLY +  35, "long-35"  , int, l_35 , , xap_int) \
+	_(XAP_LONG_ONLY +  36, "long-36"  , int, l_36 , , xap_int) \
+	_(XAP_LONG_ONLY +  37, "long-37"  , int, l_37 , , xap_int) \
+	_(XAP_LONG_ONLY +  38, "long-38"  , int, l_38 , , xap_int) \
+	_(XAP_LONG_ONLY +  39, "long-39"  , int, l_39 , , xap_int) \
+	_(XAP_LONG_ONLY +  40, "long-40"  , int, l_40 , , xap_int) \
+	_(XAP_LONG_ONLY +  41, "long-41"  , int, l_41 , , xap_int) \
+	_(XAP_LONG_ONLY +  42, "long-42"  , int, l_42 , , xap_int) \
+	_(XAP_LONG_ONLY +  43, "long-43"  , int, l_43 , , xap_int) \
+	_(XAP_LONG_ONLY +  44, "long-44"  , int, l_44 , , xap_int) \
+	_(XAP_LONG_ONLY +  45, "long-45"  , int, l_45 , , xap_int) \
+	_(XAP_LONG_ONLY +  46, "long-46"  , int, l_46 , , xap_int) \
+	_(XAP_LONG_ONLY +  47, "long-47"  , int, l_47 , , xap_int) \
+	_(XAP_LONG_ONLY +  48, "long-48"  , int, l_48 , , xap_int) \
+	_(XAP_LONG_ONLY +  49, "long-49"  , int, l_49 , , xap_int) \
+	_(XAP_LONG_ONLY +  50, "long-50"  , int, l_50 , , xap_int) \
+	_(XAP_LONG_ONLY +  51, "long-51"  , int, l_51 , , xap_int) \
+	_(XAP_LONG_ONLY +  52, "long-52"  , int, l_52 , , xap_int) \
+	_(XAP_LONG_ONLY +  53, "long-53"  , int, l_53 , , xap_int) \
+	_(XAP_LONG_ONLY +  54, "long-54"  , int, l_54 , , xap_int) \
+	_(XAP_LONG_ONLY +  55, "long-55"  , int, l_55 , , xap_int) \
+	_(XAP_LONG_ONLY +  56, "long-56"  , int, l_56 , , xap_int) \
+	_(XAP_LONG_ONLY +  57, "long-57"  , int, l_57 , , xap_int) \
+	_(XAP_LONG_ONLY +  58, "long-58"  , int, l_58 , , xap_int) \
+	_(XAP_LONG_ONLY +  59, "long-59"  , int, l_59 , , xap_int) \
+	_(XAP_LONG_ONLY +  60, "long-60"  , int, l_60 , , xap_int) \
+	_(XAP_LONG_ONLY +  61, "long-61"  , int, l_61 , , xap_int) \
+	_(XAP_LONG_ONLY +  62, "long-62"  , int, l_62 , , xap_int) \
+	_(XAP_LONG_ONLY +  63, "long-63"  , int, l_63 , , xap_int) \
+
+#define longs_65_256(_) \
+	_(XAP_LONG_ONLY +  64, "long-64"  , int, l_64 , , xap_int) \
+	_(XAP_LONG_ONLY +  65, "long-65"  , int, l_65 , , xap_int) \
+	_(XAP_LONG_ONLY +  66, "long-66"  , int, l_66 , , xap_int) \
+	_(XAP_LONG_ONLY +  67, "long-67"  , int, l_67 , , xap_int) \
+	_(XAP_LONG_ONLY +  68, "long-68"  , int, l_68 , , xap_int) \
+	_(XAP_LONG_ONLY +  69, "long-69"  , int, l_69 , , xap_int) \
+	_(XAP_LONG_ONLY +  70, "long-70"  , int, l_70 , , xap_int) \
+	_(XAP_LONG_ONLY +  71, "long-71"  , int, l_71 , , xap_int) \
+	_(XAP_LONG_ONLY +  72, "long-72"  , int, l_72 , , xap_int) \
+	_(XAP_LONG_ONLY +  73, "long-73"  , int, l_73 , , xap_int) \
+	_(XAP_LONG_ONLY +  74, "long-74"  , int, l_74 , , xap_int) \
+	_(XAP_LONG_ONLY +  75, "long-75"  , int, l_75 , , xap_int) \
+	_(XAP_LONG_ONLY +  76, "long-76"  , int, l_76 , , xap_int) \
+	_(XAP_LONG_ONLY +  77, "long-77"  , int, l_77 , , xap_int) \
+	_(XAP_LONG_ONLY +  78, "long-78"  , int, l_78 , , xap_int) \
+	_(XAP_LONG_ONLY +  79, "long-79"  , int, l_79 , , xap_int) \
+	_(XAP_LONG_ONLY +  80, "long-80"  , int, l_80 , , xap_int) \
+	_(XAP_LONG_ONLY +  81, "long-81"  , int, l_81 , , xap_int) \
+	_(XAP_LONG_ONLY +  82, "long-82"  , int, l_82 , , xap_int) \
+	_(XAP_LONG_ONLY +  83, "long-83"  , int, l_83 , , xap_int) \
+	_(XAP_LONG_ONLY +  84, "long-84"  , int, l_84 , , xap_int) \
+	_(XAP_LONG_ONLY +  85, "long-85"  , int, l_85 , , xap_int) \
+	_(XAP_LONG_ONLY +  86, "long-86"  , int, l_86 , , xap_int) \
+	_(XAP_LONG_ONLY +  87, "long-87"  , int, l_87 , , xap_int) \
+	_(XAP_LONG_ONLY +  88, "long-88"  , int, l_88 , , xap_int) \
+	_(XAP_LONG_ONLY +  89, "long-89"  , int, l_89 , , xap_int) \
+	_(XAP_LONG_ONLY +  90, "long-90"  , int, l_90 , , xap_int) \
+	_(XAP_LONG_ONLY +  91, "long-91"  , int, l_91 , , xap_int) \
+	_(XAP_LONG_ONLY +  92, "long-92"  , int, l_92 , , xap_int) \
+	_(XAP_LONG_ONLY +  93, "long-93"  , int, l_93 , , xap_int) \
+	_(XAP_LONG_ONLY +  94, "long-94"  , int, l_94 , , xap_int) \
+	_(XAP_LONG_ONLY +  95, "long-95"  , int, l_95 , , xap_int) \
+	_(XAP_LONG_ONLY +  96, "long-96"  , int, l_96 , , xap_int) \
+	_(XAP_LONG_ONLY +  97, "long-97"  , int, l_97 , , xap_int) \
+	_(XAP_LONG_ONLY +  98, "long-98"  , int, l_98 , , xap_int) \
+	_(XAP_LONG_ONLY +  99, "long-99"  , int, l_99 , , xap_int) \
+	_(XAP_LONG_ONLY + 100, "long-100" , int, l_100, , xap_int) \
+	_(XAP_LONG_ONLY + 101, "long-101" , int, l_101, , xap_int) \
+	_(XAP_LONG_ONLY + 102, "long-102" , int, l_102, , xap_int) \
+	_(XAP_LONG_ONLY + 103, "long-103" , int, l_103, , xap_int) \
+	_(XAP_LONG_ONLY + 104, "long-104" , int, l_104, , xap_int) \
+	_(XAP_LONG_ONLY + 105, "long-105" , int, l_105, , xap_int) \
+	_(XAP_LONG_ONLY + 106, "long-106" , int, l_106, , xap_int) \
+	_(XAP_LONG_ONLY + 107, "long-107" , int, l_107, , xap_int) \
+	_(XAP_LONG_ONLY + 108, "long-108" , int, l_108, , xap_int) \
+	_(XAP_LONG_ONLY + 109, "long-109" , int, l_109, , xap_int) \
+	_(XAP_LONG_ONLY + 110, "long-110" , int, l_110, , xap_int) \
+	_(XAP_LONG_ONLY + 111, "long-111" , int, l_111, , xap_int) \
+	_(XAP_LONG_ONLY + 112, "long-112" , int, l_112, , xap_int) \
+	_(XAP_LONG_ONLY + 113, "long-113" , int, l_113, , xap_int) \
+	_(XAP_LONG_ONLY + 114, "long-114" , int, l_114, , xap_int) \
+	_(XAP_LONG_ONLY + 115, "long-115" , int, l_115, , xap_int) \
+	_(XAP_LONG_ONLY + 116, "long-116" , int, l_116, , xap_int) \
+	_(XAP_LONG_ONLY + 117, "long-117" , int, l_117, , xap_int) \
+	_(XAP_LONG_ONLY + 118, "long-118" , int, l_118, , xap_int) \
+	_(XAP_LONG_ONLY + 119, "long-119" , int, l_119, , xap_int) \
+	_(XAP_LONG_ONLY + 120, "long-120" , int, l_120, , xap_int) \
+	_(XAP_LONG_ONLY + 121, "long-121" , int, l_121, , xap_int) \
+	_(XAP_LONG_ONLY + 122, "long-122" , int, l_122, , xap_int) \
+	_(XAP_LONG_ONLY + 123, "long-123" , int, l_123, , xap_int) \
+	_(XAP_LONG_ONLY + 124, "long-124" , int, l_124, , xap_int) \
+	_(XAP_LONG_ONLY + 125, "long-125" , int, l_125, , xap_int) \
+	_(XAP_LONG_ONLY + 126, "long-126" , int, l_126, , xap_int) \
+	_(XAP_LONG_ONLY + 127, "long-127" , int, l_127, , xap_int) \
+	_(XAP_LONG_ONLY + 128, "long-128" , int, l_128, , xap_int) \
+	_(XAP_LONG_ONLY + 129, "long-129" , int, l_129, , xap_int) \
+	_(XAP_LONG_ONLY + 130, "long-130" , int, l_130, , xap_int) \
+	_(XAP_LONG_ONLY + 131, "long-131" , int, l_131, , xap_int) \
+	_(XAP_LONG_ONLY + 132, "long-132" , int, l_132, , xap_int) \
+	_(XAP_LONG_ONLY + 133, "long-133" , int, l_133, , xap_int) \
+	_(XAP_LONG_ONLY + 134, "long-134" , int, l_134, , xap_int) \
+	_(XAP_LONG_ONLY + 135, "long-135" , int, l_135, , xap_int) \
+	_(XAP_LONG_ONLY + 136, "long-136" , int, l_136, , xap_int) \
+	_(XAP_LONG_ONLY + 137, "long-137" , int, l_137, , xap_int) \
+	_(XAP_LONG_ONLY + 138, "long-138" , int, l_138, , xap_int) \
+	_(XAP_LONG_ONLY + 139, "long-139" , int, l_139, , xap_int) \
+	_(XAP_LONG_ONLY + 140, "long-140" , int, l_140, , xap_int) \
+	_(XAP_LONG_ONLY + 141, "long-141" , int, l_141, , xap_int) \
+	_(XAP_LONG_ONLY + 142, "long-142" , int, l_142, , xap_int) \
+	_(XAP_LONG_ONLY + 143, "long-143" , int, l_143, , xap_int) \
+	_(XAP_LONG_ONLY + 144, "long-144" , int, l_144, , xap_int) \
+	_(XAP_LONG_ONLY + 145, "long-145" , int, l_145, , xap_int) \
+	_(XAP_LONG_ONLY + 146, "long-146" , int, l_146, , xap_int) \
+	_(XAP_LONG_ONLY + 147, "long-147" , int, l_147, , xap_int) \
+	_(XAP_LONG_ONLY + 148, "long-148" , int, l_148, , xap_int) \
+	_(XAP_LONG_ONLY + 149, "long-149" , int, l_149, , xap_int) \
+	_(XAP_LONG_ONLY + 150, "long-150" , int, l_150, , xap_int) \
+	_(XAP_LONG_ONLY + 151, "long-151" , int, l_151, , xap_int) \
+	_(XAP_LONG_ONLY + 152, "long-152" , int, l_152, , xap_int) \
+	_(XAP_LONG_ONLY + 153, "long-153" , int, l_153, , xap_int) \
+	_(XAP_LONG_ONLY + 154, "long-154" , int, l_154, , xap_int) \
+	_(XAP_LONG_ONLY + 155, "long-155" , int, l_155, , xap_int) \
+	_(XAP_LONG_ONLY + 156, "long-156" , int, l_156, , xap_int) \
+	_(XAP_LONG_ONLY + 157, "long-157" , int, l_157, , xap_int) \
+	_(XAP_LONG_ONLY + 158, "long-158" , int, l_158, , xap_int) \
+	_(XAP_LONG_ONLY + 159, "long-159" , int, l_159, , xap_int) \
+	_(XAP_LONG_ONLY + 160, "long-160" , int, l_160, , xap_int) \
+	_(XAP_LONG_ONLY + 161, "long-161" , int, l_161, , xap_int) \
+	_(XAP_LONG_ONLY + 162, "long-162" , int, l_162, , xap_int) \
+	_(XAP_LONG_ONLY + 163, "long-163" , int, l_163, , xap_int) \
+	_(XAP_LONG_ONLY + 164, "long-164" , int, l_164, , xap_int) \
+	_(XAP_LONG_ONLY + 165, "long-165" , int, l_165, , xap_int) \
+	_(XAP_LONG_ONLY + 166, "long-166" , int, l_166, , xap_int) \
+	_(XAP_LONG_ONLY + 167, "long-167" , int, l_167, , xap_int) \
+	_(XAP_LONG_ONLY + 168, "long-168" , int, l_168, , xap_int) \
+	_(XAP_LONG_ONLY + 169, "long-169" , int, l_169, , xap_int) \
+	_(XAP_LONG_ONLY + 170, "long-170" , int, l_170, , xap_int) \
+	_(XAP_LONG_ONLY + 171, "long-171" , int, l_171, , xap_int) \
+	_(XAP_LONG_ONLY + 172, "long-172" , int, l_172, , xap_int) \
+	_(XAP_LONG_ONLY + 173, "long-173" , int, l_173, , xap_int) \
+	_(XAP_LONG_ONLY + 174, "long-174" , int, l_174, , xap_int) \
+	_(XAP_LONG_ONLY + 175, "long-175" , int, l_175, , xap_int) \
+	_(XAP_LONG_ONLY + 176, "long-176" , int, l_176, , xap_int) \
+	_(XAP_LONG_ONLY + 177, "long-177" , int, l_177, , xap_int) \
+	_(XAP_LONG_ONLY + 178, "long-178" , int, l_178, , xap_int) \
+	_(XAP_LONG_ONLY + 179, "long-179" , int, l_179, , xap_int) \
+	_(XAP_LONG_ONLY + 180, "long-180" , int, l_180, , xap_int) \
+	_(XAP_LONG_ONLY + 181, "long-181" , int, l_181, , xap_int) \
+	_(XAP_LONG_ONLY + 182, "long-182" , int, l_182, , xap_int) \
+	_(XAP_LONG_ONLY + 183, "long-183" , int, l_183, , xap_int) \
+	_(XAP_LONG_ONLY + 184, "long-184" , int, l_184, , xap_int) \
+	_(XAP_LONG_ONLY + 185, "long-185" , int, l_185, , xap_int) \
+	_(XAP_LONG_ONLY + 186, "long-186" , int, l_186, , xap_int) \
+	_(XAP_LONG_ONLY + 187, "long-187" , int, l_187, , xap_int) \
+	_(XAP_LONG_ONLY + 188, "long-188" , int, l_188, , xap_int) \
+	_(XAP_LONG_ONLY + 189, "long-189" , int, l_189, , xap_int) \
+	_(XAP_LONG_ONLY + 190, "long-190" , int, l_190, , xap_int) \
+	_(XAP_LONG_ONLY + 191, "long-191" , int, l_191, , xap_int) \
+	_(XAP_LONG_ONLY + 192, "long-192" , int, l_192, , xap_int) \
+	_(XAP_LONG_ONLY + 193, "long-193" , int, l_193, , xap_int) \
+	_(XAP_LONG_ONLY + 194, "long-194" , int, l_194, , xap_int) \
+	_(XAP_LONG_ONLY + 195, "long-195" , int, l_195, , xap_int) \
+	_(XAP_LONG_ONLY + 196, "long-196" , int, l_196, , xap_int) \
+	_(XAP_LONG_ONLY + 197, "long-197" , int, l_197, , xap_int) \
+	_(XAP_LONG_ONLY + 198, "long-198" , int, l_198, , xap_int) \
+	_(XAP_LONG_ONLY + 199, "long-199" , int, l_199, , xap_int) \
+	_(XAP_LONG_ONLY + 200, "long-200" , int, l_200, , xap_int) \
+	_(XAP_LONG_ONLY + 201, "long-201" , int, l_201, , xap_int) \
+	_(XAP_LONG_ONLY + 202, "long-202" , int, l_202, , xap_int) \
+	_(XAP_LONG_ONLY + 203, "long-203" , int, l_203, , xap_int) \
+	_(XAP_LONG_ONLY + 204, "long-204" , int, l_204, , xap_int) \
+	_(XAP_LONG_ONLY + 205, "long-205" , int, l_205, , xap_int) \
+	_(XAP_LONG_ONLY + 206, "long-206" , int, l_206, , xap_int) \
+	_(XAP_LONG_ONLY + 207, "long-207" , int, l_207, , xap_int) \
+	_(XAP_LONG_ONLY + 208, "long-208" , int, l_208, , xap_int) \
+	_(XAP_LONG_ONLY + 209, "long-209" , int, l_209, , xap_int) \
+	_(XAP_LONG_ONLY + 210, "long-210" , int, l_210, , xap_int) \
+	_(XAP_LONG_ONLY + 211, "long-211" , int, l_211, , xap_int) \
+	_(XAP_LONG_ONLY + 212, "long-212" , int, l_212, , xap_int) \
+	_(XAP_LONG_ONLY + 213, "long-213" , int, l_213, , xap_int) \
+	_(XAP_LONG_ONLY + 214, "long-214" , int, l_214, , xap_int) \
+	_(XAP_LONG_ONLY + 215, "long-215" , int, l_215, , xap_int) \
+	_(XAP_LONG_ONLY + 216, "long-216" , int, l_216, , xap_int) \
+	_(XAP_LONG_ONLY + 217, "long-217" , int, l_217, , xap_int) \
+	_(XAP_LONG_ONLY + 218, "long-218" , int, l_218, , xap_int) \
+	_(XAP_LONG_ONLY + 219, "long-219" , int, l_219, , xap_int) \
+	_(XAP_LONG_ONLY + 220, "long-220" , int, l_220, , xap_int) \
+	_(XAP_LONG_ONLY + 221, "long-221" , int, l_221, , xap_int) \
+	_(XAP_LONG_ONLY + 222, "long-222" , int, l_222, , xap_int) \
+	_(XAP_LONG_ONLY + 223, "long-223" , int, l_223, , xap_int) \
+	_(XAP_LONG_ONLY + 224, "long-224" , int, l_224, , xap_int) \
+	_(XAP_LONG_ONLY + 225, "long-225" , int, l_225, , xap_int) \
+	_(XAP_LONG_ONLY + 226, "long-226" , int, l_226, , xap_int) \
+	_(XAP_LONG_ONLY + 227, "long-227" , int, l_227, , xap_int) \
+	_(XAP_LONG_ONLY + 228, "long-228" , int, l_228, , xap_int) \
+	_(XAP_LONG_ONLY + 229, "long-229" , int, l_229, , xap_int) \
+	_(XAP_LONG_ONLY + 230, "long-230" , int, l_230, , xap_int) \
+	_(XAP_LONG_ONLY + 231, "long-231" , int, l_231, , xap_int) \
+	_(XAP_LONG_ONLY + 232, "long-232" , int, l_232, , xap_int) \
+	_(XAP_LONG_ONLY + 233, "long-233" , int, l_233, , xap_int) \
+	_(XAP_LONG_ONLY + 234, "long-234" , int, l_234, , xap_int) \
+	_(XAP_LONG_ONLY + 235, "long-235" , int, l_235, , xap_int) \
+	_(XAP_LONG_ONLY + 236, "long-236" , int, l_236, , xap_int) \
+	_(XAP_LONG_ONLY + 237, "long-237" , int, l_237, , xap_int) \
+	_(XAP_LONG_ONLY + 238, "long-238" , int, l_238, , xap_int) \
+	_(XAP_LONG_ONLY + 239, "long-239" , int, l_239, , xap_int) \
+	_(XAP_LONG_ONLY + 240, "long-240" , int, l_240, , xap_int) \
+	_(XAP_LONG_ONLY + 241, "long-241" , int, l_241, , xap_int) \
+	_(XAP_LONG_ONLY + 242, "long-242" , int, l_242, , xap_int) \
+	_(XAP_LONG_ONLY + 243, "long-243" , int, l_243, , xap_int) \
+	_(XAP_LONG_ONLY + 244, "long-244" , int, l_244, , xap_int) \
+	_(XAP_LONG_ONLY + 245, "long-245" , int, l_245, , xap_int) \
+	_(XAP_LONG_ONLY + 246, "long-246" , int, l_246, , xap_int) \
+	_(XAP_LONG_ONLY + 247, "long-247" , int, l_247, , xap_int) \
+	_(XAP_LONG_ONLY + 248, "long-248" , int, l_248, , xap_int) \
+	_(XAP_LONG_ONLY + 249, "long-249" , int, l_249, , xap_int) \
+	_(XAP_LONG_ONLY + 250, "long-250" , int, l_250, , xap_int) \
+	_(XAP_LONG_ONLY + 251, "long-251" , int, l_251, , xap_int) \
+	_(XAP_LONG_ONLY + 252, "long-252" , int, l_252, , xap_int) \
+	_(XAP_LONG_ONLY + 253, "long-253" , int, l_253, , xap_int) \
+	_(XAP_LONG_ONLY + 254, "long-254" , int, l_254, , xap_int) \
+	_(XAP_LONG_ONLY + 255, "long-255" , int, l_255, , xap_int) \
+
+#define program(_) \
+	_(0, NULL, char const *, program, , xap_string) \
+
+#define set_1(_)      program(_) shorts_1(_)
+#define set_8(_)      set_1(_) shorts_2_8(_)
+#define set_26(_)     set_8(_) shorts_9_26(_)
+#define set_62(_)     set_26(_) shorts_27_62(_)
+#define set_93(_)     set_62(_) shorts_63_93(_)
+#define set_95(_)     set_93(_) shorts_94_95(_)
+#define set_93_256(_) set_93(_) longs_1_64(_) longs_65_256(_)
+
+#define none(_)
+
+/* counts what is allocated through malloc and friends, except under the
+ * sanitizers, which bring their own */
+static size_t n_allocs, n_bytes;
+
+#if !defined(__SANITIZE_ADDRESS__) && !defined(__SANITIZE_THREAD__)
+
+extern void * __libc_malloc(size_t size);
+extern void * __libc_calloc(size_t n, size_t size);
+extern void * __libc_realloc(void * p, size_t size);
+
+void * malloc(size_t size)
+{
+	n_allocs++, n_bytes += size;
+	return __libc_malloc(size);
+}
+
+void * calloc(size_t n, size_t size)
+{
+	n_allocs++, n_bytes += n * size;
+	return __libc_calloc(n, size);
+}
+
+void * realloc(void * p, size_t size)
+{
+	n_allocs++, n_bytes += size;
+	return __libc_realloc(p, size);
+}
+#endif
+
+/* what getopt_long needs to know about each argument */
+typedef struct spec {
+	int sopt;
+	char const * lopt;
+	bool keyword;
+	bool toggle;
+	size_t offset;
+	xap_assign conv;
+} spec_t;
+
+#define derive_spec(sopt, lopt, type, name, arry, conv) \
+	{ \
+		(int)(sopt), \
+		lopt, \
+		xap_derive_is_keyword(sopt, lopt), \
+		_Generic(((spec_struct *)NULL)->name, bool: true, default: false), \
+		offsetof(spec_struct, name), \
+		(xap_assign)(void (*)(void))conv, \
+	},
+
+typedef struct set {
+	char const * name;
+	size_t size, n_specs;
+	spec_t const * specs;
+	xap_parser_t parse, tparse;
+} set_t;
+
+#define define_set(set, label) \
+	struct set xap_struct(set); \
+	xap_define_parser(set ## _parse, struct set, set, none, none); \
+	xap_define_table(set ## _table, struct set, set, none, none, none); \
+	xap_define_table_parser(set ## _tparse, struct set, set ## _table); \
+	static xap_error_context_t set ## _parse_any(int * argc, char ** argv, void * args) \
+	{ \
+		return set ## _parse(argc, argv, args); \
+	} \
+	static xap_error_context_t set ## _tparse_any(int * argc, char ** argv, void * args) \
+	{ \
+		return set ## _tparse(argc, argv, args); \
+	} \
+	static set_t set ## _set(void) \
+	{ \
+		typedef struct set spec_struct; \
+		static const spec_t specs[] = { set(derive_spec) }; \
+		return (set_t){ \
+			label, sizeof(struct set), sizeof(specs) / sizeof(specs[0]), specs, \
+			set ## _parse_any, set ## _tparse_any, \
+		}; \
+	}
+
+define_set(set_1, "1")
+define_set(set_8, "8")
+define_set(set_26, "26")
+define_set(set_62, "62")
+define_set(set_93, "93")
+define_set(set_95, "95")
+define_set(set_93_256, "93+256")
+
+/* getopt_long takes anything but ':' and ';' (and "W;") as a short option */
+static bool getopt_can_parse(set_t const * set)
+{
+	for (size_t k = 0; k < set->n_specs; k++)
+		if (set->specs[k].keyword && (set->specs[k].sopt == ':' || set->specs[k].sopt == ';')) return false;
+	return true;
+}
+
+/* getopt_long with the same converters and the same argc/argv contract */
+static xap_error_context_t getopt_parse(set_t const * set, int * argc, char ** argv, void * args)
+{
+	static struct option longs[XAP_LONG_ONLY + 257];
+	static char optstring[3 * 256];
+	static int by_val[XAP_LONG_ONLY + 256];
+	static bool has_question_mark;
+	static set_t const * ready;
+	if (ready != set) {
+		char * o = optstring;
+		size_t n = 0;
+		for (size_t k = 0; k < set->n_specs; k++) {
+			spec_t const * spec = set->specs + k;
+			if (!spec->keyword) continue;
+			by_val[spec->sopt] = k;
+			if (xap_has_sopt(spec->sopt)) {
+				*o++ = spec->sopt;
+				if (!spec->toggle) *o++ = ':';
+			}
+			longs[n++] = (struct option){ spec->lopt, spec->toggle ? no_argument : required_argument, NULL, spec->sopt };
+		}
+		*o = '\0';
+		longs[n] = (struct option){ 0 };
+		has_question_mark = strchr(optstring, '?') != NULL;
+		ready = set;
+	}
+
+	xap_error_context_t ctx = { 0 };
+	int consumed, c;
+	optind = 0;
+	opterr = 0;
+	while ((c = getopt_long(*argc, argv, optstring, longs, NULL)) != -1) {
+		/* '?' is also an option in the larger sets, and no workload has errors */
+		if (c == ':' || (c == '?' && !has_question_mark)) {
+			ctx.error = "getopt_long failed";
+			return ctx;
+		}
+		spec_t const * spec = set->specs + by_val[c];
+		ctx.error = spec->conv(spec->toggle ? 0 : 1, &optarg, (char *)args + spec->offset, &consumed);
+		if (ctx.error) return ctx;
+	}
+	/* the sets only declare positional 0, and getopt_long moved the others to the end */
+	ctx.error = set->specs[0].conv(*argc, argv, (char *)args + set->specs[0].offset, &consumed);
+	int n = 0;
+	for (int k = optind; k < *argc; k++) argv[n++] = argv[k];
+	*argc = n;
+	return ctx;
+}
+
+/* workloads */
+enum shape { CLUSTERED, KEY_VALUE, POSITIONAL, HUGE, N_SHAPES };
+static char const * const shape_names[N_SHAPES] = { "clustered", "key=value", "positional", "huge" };
+
+typedef struct workload {
+	int argc, size;
+	char ** argv;
+} workload_t;
+
+static void push(workload_t * w, char const * format, ...)
+{
+	char buffer[64];
+	va_list ap;
+	va_start(ap, format);
+	vsnprintf(buffer, sizeof(buffer), format, ap);
+	va_end(ap);
+	if (w->argc + 1 >= w->size) {
+		w->size = w->size ? 2 * w->size : 64;
+		w->argv = realloc(w->argv, w->size * sizeof(char *));
+		if (w->argv == NULL) exit(2);
+	}
+	w->argv[w->argc++] = strdup(buffer);
+	w->argv[w->argc] = NULL;
+}
+
+static uint32_t next_random(void)
+{
+	static uint32_t state = 1;
+	state = state * 1103515245u + 12345u;
+	return state >> 8;
+}
+
+static workload_t build(set_t const * set, enum shape shape)
+{
+	workload_t w = { 0 };
+	push(&w, "prog");
+
+	/* every keyword once, in random order */
+	size_t order[512], n = 0;
+	for (size_t k = 0; k < set->n_specs; k++) if (set->specs[k].keyword) order[n++] = k;
+	for (size_t k = n; k > 1; k--) {
+		size_t j = next_random() % k, t = order[k - 1];
+		order[k - 1] = order[j];
+		order[j] = t;
+	}
+
+	int n_positionals = shape == POSITIONAL ? 16 : shape == HUGE ? (1 << 20) / (int)n : 0;
+	char cluster[16];
+	size_t len = 0;
+	for (size_t k = 0; k < n; k++) {
+		spec_t const * spec = set->specs + order[k];
+		int value = next_random() % 100000 - 50000;
+		/* long-only options and '-', which cannot start a cluster, go in their long form */
+		if (shape != CLUSTERED || !xap_has_sopt(spec->sopt) || spec->sopt == '-') {
+			if (spec->toggle) push(&w, "--%s", spec->lopt);
+			else if (shape == CLUSTERED) push(&w, "--%s", spec->lopt), push(&w, "%d", value);
+			else push(&w, "--%s=%d", spec->lopt, value);
+		}
+		else if (spec->toggle) {
+			cluster[len++] = spec->sopt;
+			if (len == 6) push(&w, "-%.*s", (int)len, cluster), len = 0;
+		}
+		else {
+			push(&w, "-%.*s%c%d", (int)len, cluster, spec->sopt, value);
+			len = 0;
+		}
+		for (int p = 0; p < n_positionals; p++) push(&w, "file%d", (int)(next_random() % 1000));
+	}
+	if (len) push(&w, "-%.*s", (int)len, cluster);
+	return w;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + 1e-9 * t.tv_nsec;
+}
+
+enum parser { MACRO, TABLE, GETOPT, N_PARSERS };
+static char const * const parser_names[N_PARSERS] = { "xap macro", "xap table", "getopt_long" };
+
+/* the fields and leftovers of the last parse */
+typedef struct result {
+	char * args;
+	int argc;
+	char ** argv;
+	char const * error;
+} result_t;
+
+typedef struct measurement {
+	double ns_per_arg;
+	double allocs, bytes;  /* per parse */
+} measurement_t;
+
+static measurement_t run(set_t const * set, enum parser parser, workload_t const * w, result_t * result)
+{
+	int repeat = 4000000 / w->argc + 1;
+	if (parser == GETOPT && w->argc > 100000) repeat = 1;
+	size_t allocs = n_allocs, bytes = n_bytes;
+	double start = now();
+	for (int r = 0; r < repeat; r++) {
+		memcpy(result->argv, w->argv, (w->argc + 1) * sizeof(char *));
+		memset(result->args, 0, set->size);
+		result->argc = w->argc;
+		xap_error_context_t ctx = parser == MACRO ? set->parse(&result->argc, result->argv, result->args)
+			: parser == TABLE ? set->tparse(&result->argc, result->argv, result->args)
+			: getopt_parse(set, &result->argc, result->argv, result->args);
+		result->error = ctx.error;
+	}
+	double elapsed = now() - start;
+	return (measurement_t){
+		elapsed / repeat / w->argc * 1e9,
+		(double)(n_allocs - allocs) / repeat,
+		(double)(n_bytes - bytes) / repeat,
+	};
+}
+
+static bool same(set_t const * set, result_t const * a, result_t const * b)
+{
+	if (a->error || b->error) return false;
+	if (a->argc != b->argc || memcmp(a->args, b->args, set->size) != 0) return false;
+	for (int k = 0; k < a->argc; k++) if (a->argv[k] != b->argv[k]) return false;
+	return true;
+}
+
+/* every set and shape with every parser */
+static int parsers_suite(void)
+{
+	set_t sets[] = { set_1_set(), set_8_set(), set_26_set(), set_62_set(), set_93_set(), set_95_set(), set_93_256_set() };
+	int failures = 0;
+	printf("%-7s %-10s %8s %-11s %8s %7s %8s\n", "set", "shape", "argc", "parser", "ns/arg", "allocs", "bytes");
+	for (size_t s = 0; s < sizeof(sets) / sizeof(sets[0]); s++) {
+		int n_parsers = getopt_can_parse(sets + s) ? N_PARSERS : GETOPT;
+		for (int shape = 0; shape < N_SHAPES; shape++) {
+			workload_t w = build(sets + s, shape);
+			result_t results[N_PARSERS];
+			for (int p = 0; p < n_parsers; p++) {
+				results[p].args = calloc(1, sets[s].size);
+				results[p].argv = malloc((w.argc + 1) * sizeof(char *));
+				measurement_t m = run(sets + s, p, &w, results + p);
+				printf("%-7s %-10s %8d %-11s %8.2f %7.1f %8.0f\n", sets[s].name, shape_names[shape], w.argc, parser_names[p],
+					m.ns_per_arg, m.allocs, m.bytes);
+			}
+			for (int p = 1; p < n_parsers; p++) {
+				if (same(sets + s, results, results + p)) continue;
+				printf("MISMATCH: %s and %s on %s/%s (%s, %s)\n", parser_names[0], parser_names[p], sets[s].name, shape_names[shape],
+					results[0].error ? results[0].error : "ok", results[p].error ? results[p].error : "ok");
+				failures++;
+			}
+			for (int p = 0; p < n_parsers; p++) free(results[p].args), free(results[p].argv);
+			for (int k = 0; k < w.argc; k++) free(w.argv[k]);
+			free(w.argv);
+		}
+	}
+	return failures;
+}
+
+/* scaling: "-I k file" repeated up to argc, so that two thirds of argv are
+ * consumed and the rest are leftovers, from 10 to 1,000,000 arguments; a
+ * parser that shifted argv once per option would be quadratic in argc, and
+ * so is getopt_long, which moves the positionals it has seen past every
+ * option after them, so it stops at 100,000 */
+xap_define_append(append_int, int, xap_int)
+
+#define scaling(_) \
+	_(  0, NULL     , char const *, program, , xap_string) \
+	_('I', "include", xap_list_t  , include, , append_int) \
+
+struct scaling xap_struct(scaling);
+xap_define_parser(scaling_parse, struct scaling, scaling, none, none);
+xap_define_table(scaling_table, struct scaling, scaling, none, none, none);
+xap_define_table_parser(scaling_tparse, struct scaling, scaling_table);
+
+static xap_error_context_t scaling_getopt(int * argc, char ** argv, struct scaling * args)
+{
+	static const struct option longs[] = { { "include", required_argument, NULL, 'I' }, { 0 } };
+	xap_error_context_t ctx = { 0 };
+	int consumed, c;
+	optind = 0;
+	opterr = 0;
+	while ((c = getopt_long(*argc, argv, "I:", longs, NULL)) != -1) {
+		if (c != 'I') {
+			ctx.error = "getopt_long failed";
+			return ctx;
+		}
+		ctx.error = append_int(1, &optarg, &args->include, &consumed);
+		if (ctx.error) return ctx;
+	}
+	ctx.error = xap_string(*argc, argv, &args->program, &consumed);
+	int n = 0;
+	for (int k = optind; k < *argc; k++) argv[n++] = argv[k];
+	*argc = n;
+	return ctx;
+}
+
+static int scaling_suite(void)
+{
+	int failures = 0;
+	printf("%8s %-11s %8s\n", "argc", "parser", "ns/arg");
+	for (int size = 10; size <= 1000000; size *= 10) {
+		workload_t w = { 0 };
+		push(&w, "prog");
+		for (int k = 0; w.argc < size; k++) {
+			if (k % 3 == 0) push(&w, "-I");
+			else if (k % 3 == 1) push(&w, "%d", k);
+			else push(&w, "file%d", k);
+		}
+		void * buffer = malloc(2 * size * sizeof(int) + 64);
+		xap_arena_t arena = xap_arena(buffer, 2 * size * sizeof(int) + 64);
+		char ** argv = malloc((w.argc + 1) * sizeof(char *));
+		int leftovers[N_PARSERS];
+		size_t count[N_PARSERS];
+		long long sum[N_PARSERS];
+		for (int p = 0; p < N_PARSERS; p++) {
+			if (p == GETOPT && size > 100000) continue;
+			int repeat = p == GETOPT && size >= 10000 ? 1 : 4000000 / size + 1, argc = 0;
+			struct scaling args;
+			xap_error_context_t ctx = { 0 };
+			double start = now();
+			for (int r = 0; r < repeat; r++) {
+				memcpy(argv, w.argv, (w.argc + 1) * sizeof(char *));
+				argc = w.argc;
+				xap_arena_reset(&arena);
+				args = (struct scaling){ .include = xap_list(&arena) };
+				ctx = p == MACRO ? scaling_parse(&argc, argv, &args)
+					: p == TABLE ? scaling_tparse(&argc, argv, &args)
+					: scaling_getopt(&argc, argv, &args);
+			}
+			double ns = (now() - start) / repeat / w.argc * 1e9;
+			printf("%8d %-11s %8.2f\n", w.argc, parser_names[p], ns);
+			if (ctx.error) {
+				printf("ERROR: %s on %d arguments: %s\n", parser_names[p], w.argc, ctx.error);
+				failures++;
+			}
+			leftovers[p] = argc;
+			count[p] = args.include.count;
+			sum[p] = 0;
+			for (size_t k = 0; k < args.include.count; k++) sum[p] += ((int *)args.include.items)[k];
+		}
+		for (int p = 1; p < N_PARSERS; p++) {
+			if (p == GETOPT && size > 100000) continue;
+			if (leftovers[p] == leftovers[0] && count[p] == count[0] && sum[p] == sum[0]) continue;
+			printf("MISMATCH: %s and %s on %d arguments\n", parser_names[0], parser_names[p], w.argc);
+			failures++;
+		}
+		free(argv);
+		free(buffer);
+		for (int k = 0; k < w.argc; k++) free(w.argv[k]);
+		free(w.argv);
+	}
+	return failures;
+}
+
+/* converters: the locale-independent converters against the strtol and
+ * strtod ones on a few thousand inputs of each kind, which they must convert
+ * to the same values */
+enum { N_INPUTS = 4096 };
+
+typedef struct converter_pair {
+	char const * kind;
+	char const * old_name, * new_name;
+	xap_assign old_conv, new_conv;
+	size_t size;
+} converter_pair_t;
+
+#define converter_pair(kind, old_conv, new_conv, type) \
+	{ kind, #old_conv, #new_conv, (xap_assign)(void (*)(void))old_conv, (xap_assign)(void (*)(void))new_conv, sizeof(type) }
+
+static void make_input(char * buffer, size_t size, char const * kind)
+{
+	uint64_t bits = (uint64_t)next_random() << 40 ^ (uint64_t)next_random() << 20 ^ next_random();
+	double unit = (double)(next_random() & 0xffffff) / 0x1000000;
+	if (strcmp(kind, "small") == 0) snprintf(buffer, size, "%d", (int)(bits % 1999) - 999);
+	else if (strcmp(kind, "int32") == 0) snprintf(buffer, size, "%d", (int32_t)(uint32_t)bits);
+	else if (strcmp(kind, "int64") == 0) snprintf(buffer, size, "%lld", (long long)(int64_t)(bits << 1));
+	else if (strcmp(kind, "fixed") == 0) snprintf(buffer, size, "%.3f", 2000 * unit - 1000);
+	else if (strcmp(kind, "full") == 0) snprintf(buffer, size, "%.17g", 2000 * unit - 1000);
+	else snprintf(buffer, size, "%.6fe%d", 18 * unit - 9, (int)(bits % 601) - 300);
+}
+
+static double convert_all(xap_assign conv, char ** inputs, void * values, size_t size)
+{
+	int repeat = 1000, consumed;
+	double start = now();
+	for (int r = 0; r < repeat; r++)
+		for (int k = 0; k < N_INPUTS; k++)
+			if (conv(1, inputs + k, (char *)values + k * size, &consumed) != NULL) return -1;
+	return (now() - start) / repeat / N_INPUTS * 1e9;
+}
+
+static int converters_suite(void)
+{
+	static const converter_pair_t pairs[] = {
+		converter_pair("small"   , xap_int   , xap_int32  , int32_t),
+		converter_pair("int32"   , xap_int   , xap_int32  , int32_t),
+		converter_pair("small"   , xap_long  , xap_int64  , int64_t),
+		converter_pair("int64"   , xap_long  , xap_int64  , int64_t),
+		converter_pair("fixed"   , xap_double, xap_float64, double ),
+		converter_pair("full"    , xap_double, xap_float64, double ),
+		converter_pair("exponent", xap_double, xap_float64, double ),
+	};
+	int failures = 0;
+	char * inputs[N_INPUTS];
+	printf("%-9s %-11s %7s %-11s %7s\n", "input", "old", "ns", "new", "ns");
+	for (size_t p = 0; p < sizeof(pairs) / sizeof(pairs[0]); p++) {
+		converter_pair_t const * pair = pairs + p;
+		for (int k = 0; k < N_INPUTS; k++) {
+			char buffer[64];
+			make_input(buffer, sizeof(buffer), pair->kind);
+			inputs[k] = strdup(buffer);
+		}
+		void * old_values = calloc(N_INPUTS, pair->size), * new_values = calloc(N_INPUTS, pair->size);
+		double old_ns = convert_all(pair->old_conv, inputs, old_values, pair->size);
+		double new_ns = convert_all(pair->new_conv, inputs, new_values, pair->size);
+		printf("%-9s %-11s %7.2f %-11s %7.2f\n", pair->kind, pair->old_name, old_ns, pair->new_name, new_ns);
+		if (old_ns < 0 || new_ns < 0 || memcmp(old_values, new_values, N_INPUTS * pair->size) != 0) {
+			printf("MISMATCH: %s and %s on %s inputs\n", pair->old_name, pair->new_name, pair->kind);
+			failures++;
+		}
+		free(old_values);
+		free(new_values);
+		for (int k = 0; k < N_INPUTS; k++) free(inputs[k]);
+	}
+	return failures;
+}
+
+/* batch: the same 65536 command lines (set 26, clustered and key=value in
+ * turn) through xap_parse_batch on 1, 2, 4, ... threads up to the number of
+ * online CPUs, in command lines per second; every run has to give the same
+ * fields and leftovers as parsing them one by one */
+xap_define_batch_parser(set_26_batch, struct set_26, set_26_parse)
+xap_define_batch_parser(set_26_tbatch, struct set_26, set_26_tparse)
+
+static int batch_suite(void)
+{
+	enum { N_ITEMS = 65536 };
+	set_t set = set_26_set();
+	workload_t w[2] = { build(&set, CLUSTERED), build(&set, KEY_VALUE) };
+	size_t n_pointers = 0;
+	for (int k = 0; k < N_ITEMS; k++) n_pointers += w[k % 2].argc + 1;
+	char ** pointers = malloc(n_pointers * sizeof(char *));
+	xap_batch_item_t * items = malloc(N_ITEMS * sizeof(xap_batch_item_t));
+	xap_error_context_t * results = malloc(N_ITEMS * sizeof(xap_error_context_t));
+	struct set_26 * args = malloc(N_ITEMS * sizeof(struct set_26)), expected[2];
+	int expected_argc[2];
+	for (int k = 0; k < 2; k++) {
+		char ** argv = malloc((w[k].argc + 1) * sizeof(char *));
+		memcpy(argv, w[k].argv, (w[k].argc + 1) * sizeof(char *));
+		expected_argc[k] = w[k].argc;
+		memset(expected + k, 0, sizeof(expected[k]));
+		set_26_parse(expected_argc + k, argv, expected + k);
+		free(argv);
+	}
+
+	/* BENCH_THREADS=n goes up to n threads instead */
+	long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	printf("%ld online CPU%s\n", n_cpus, n_cpus == 1 ? ", so there is no scaling to show" : "s");
+	if (getenv("BENCH_THREADS") != NULL) n_cpus = atol(getenv("BENCH_THREADS"));
+	if (n_cpus < 1) n_cpus = 1;
+	printf("%-11s %7s %12s %7s\n", "parser", "threads", "lines/s", "speedup");
+	int failures = 0;
+	for (int p = MACRO; p <= TABLE; p++) {
+		double base = 0;
+		for (long n_threads = 1; ; n_threads = n_threads * 2 < n_cpus ? n_threads * 2 : n_cpus) {
+			double best = 0;
+			size_t n_failed = 0;
+			for (int r = 0; r < 5; r++) {
+				char ** next = pointers;
+				for (int k = 0; k < N_ITEMS; k++) {
+					workload_t const * source = w + k % 2;
+					memcpy(next, source->argv, (source->argc + 1) * sizeof(char *));
+					items[k] = (xap_batch_item_t){ source->argc, next, args + k };
+					next += source->argc + 1;
+				}
+				memset(args, 0, N_ITEMS * sizeof(struct set_26));
+				double start = now();
+				n_failed = p == MACRO ? set_26_batch(N_ITEMS, items, results, (int)n_threads)
+					: set_26_tbatch(N_ITEMS, items, results, (int)n_threads);
+				double rate = N_ITEMS / (now() - start);
+				if (rate > best) best = rate;
+			}
+			if (n_threads == 1) base = best;
+			printf("%-11s %7ld %12.0f %7.2f\n", parser_names[p], n_threads, best, best / base);
+			for (int k = 0; k < N_ITEMS; k++) {
+				if (n_failed == 0 && items[k].argc == expected_argc[k % 2]
+					&& memcmp(args + k, expected + k % 2, sizeof(struct set_26)) == 0) continue;
+				printf("MISMATCH: %s on %ld threads, command line %d\n", parser_names[p], n_threads, k);
+				failures++;
+				break;
+			}
+			if (n_threads == n_cpus) break;
+		}
+	}
+
+	free(args);
+	free(results);
+	free(items);
+	free(pointers);
+	for (int k = 0; k < 2; k++) {
+		for (int i = 0; i < w[k].argc; i++) free(w[k].argv[i]);
+		free(w[k].argv);
+	}
+	return failures;
+}
+
+/* ./benchmark [suite...] runs the named suites, or all of them */
+int main(int argc, char ** argv)
+{
+	static const struct suite {
+		char const * name;
+		int (*run)(void);
+	} suites[] = {
+		{ "parsers", parsers_suite },
+		{ "scaling", scaling_suite },
+		{ "converters", converters_suite },
+		{ "batch", batch_suite },
+	};
+	size_t n_suites = sizeof(suites) / sizeof(suites[0]);
+	for (int i = 1; i < argc; i++) {
+		size_t k = 0;
+		while (k < n_suites && strcmp(argv[i], suites[k].name) != 0) k++;
+		if (k < n_suites) continue;
+		fprintf(stderr, "usage: %s [suite...], where the suites are", argv[0]);
+		for (k = 0; k < n_suites; k++) fprintf(stderr, " %s", suites[k].name);
+		fputc('\n', stderr);
+		return 2;
+	}
+	int failures = 0;
+	for (size_t k = 0; k < n_suites; k++) {
+		bool selected = argc == 1;
+		for (int i = 1; i < argc; i++) selected |= strcmp(argv[i], suites[k].name) == 0;
+		if (!selected) continue;
+		printf("== %s\n", suites[k].name);
+		failures += suites[k].run();
+	}
+	struct rusage usage;
+	if (getrusage(RUSAGE_SELF, &usage) == 0) printf("peak RSS: %ld KiB\n", usage.ru_maxrss);
+	return failures != 0;
+}
@@ -20,6 +20,129 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <float.h>
+#include <limits.h>
+#include <stdarg.h>
+
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+	#include <stdatomic.h>
+	#define XAP_HAVE_ATOMICS 1
+#endif
+
+#if !defined(XAP_NO_POSIX) && (defined(__unix__) || defined(__APPLE__))
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+	#define XAP_POSIX 1
+#endif
+
+/* long options are scanned for '=' with SSE2, which every x86-64 CPU has,
+ * and with AVX2 where the CPU turns out to support it at run time; NEON has
+ * not been built or tested here, so AArch64 only uses it with XAP_ENABLE_NEON
+ */
+#if !defined(XAP_NO_SIMD) && defined(__GNUC__) && defined(__SSE2__)
+	#include <emmintrin.h>
+	#define XAP_SIMD_SSE2 1
+	#if defined(__x86_64__) || defined(__i386__)
+		#include <immintrin.h>
+		#define XAP_SIMD_AVX2 1
+	#endif
+#elif !defined(XAP_NO_SIMD) && defined(XAP_ENABLE_NEON) && defined(__GNUC__) && defined(__aarch64__) && defined(__ARM_NEON)
+	#include <arm_neon.h>
+	#define XAP_SIMD_NEON 1
+#endif
+
+/* xap_parse_batch() spreads its work over pthreads when it can count on
+ * atomics as well; it runs on the calling thread otherwise */
+#if defined(XAP_POSIX) && defined(XAP_HAVE_ATOMICS) && !defined(XAP_NO_THREADS)
+	#include <pthread.h>
+	#include <sched.h>
+	#define XAP_HAVE_THREADS 1
+#endif
+
+/* opt-in counters, timers and tracing for every parser; see xap_stats_t */
+#ifdef XAP_INSTRUMENT
+	#include <time.h>
+#endif
+
+/* open_memstream() is POSIX 2008; output is not cached otherwise */
+#if defined(_POSIX_C_SOURCE) && _POSIX_C_SOURCE >= 200809L
+	#define XAP_HAVE_MEMSTREAM 1
+#endif
+
+/* strtod() follows LC_NUMERIC, so reals that need it are converted with
+ * strtod_l() in the "C" locale where there is one, and in the current locale
+ * otherwise */
+#if !defined(XAP_NO_POSIX) && ((defined(__GLIBC__) && defined(_GNU_SOURCE)) || defined(__APPLE__) || defined(__FreeBSD__))
+	#include <locale.h>
+	#ifdef __APPLE__
+		#include <xlocale.h>
+	#endif
+	#define XAP_HAVE_STRTOD_L 1
+#endif
+
+/* allow unique prefixes of long options (e.g., --ver for --version); may be
+ * redefined between parser and table definitions since it is read where they
+ * expand, and tables keep it in xap_table_t.abbreviate */
+#ifndef XAP_ALLOW_ABBREVIATIONS
+	#define XAP_ALLOW_ABBREVIATIONS 0
+#endif
+
+/* one-time initialization of static lookup structures
+ *
+ * whoever wins xap_once_begin() builds the structure and calls xap_once_end();
+ * anyone who sees it unfinished is expected to fall back to a slower path
+ * rather than wait; only xap_once_wait() blocks, for the table masks, which
+ * are shared through the table and take microseconds to build
+ */
+#ifdef XAP_HAVE_ATOMICS
+typedef atomic_int xap_once_t;
+
+static inline
+bool xap_once_done(xap_once_t * once)
+{
+	return atomic_load_explicit(once, memory_order_acquire) == 2;
+}
+
+static inline
+bool xap_once_begin(xap_once_t * once)
+{
+	int expected = 0;
+	return atomic_compare_exchange_strong(once, &expected, 1);
+}
+
+static inline
+void xap_once_end(xap_once_t * once)
+{
+	atomic_store_explicit(once, 2, memory_order_release);
+}
+#else
+typedef int xap_once_t;  /* not thread-safe without C11 atomics */
+
+static inline
+bool xap_once_done(xap_once_t * once) { return *once == 2; }
+
+static inline
+bool xap_once_begin(xap_once_t * once) { return *once == 0 ? (*once = 1) : false; }
+
+static inline
+void xap_once_end(xap_once_t * once) { *once = 2; }
+#endif
+
+/* give up the CPU until the winner of xap_once_begin() is done */
+static inline
+void xap_once_wait(xap_once_t * once)
+{
+	while (!xap_once_done(once)) {
+#ifdef XAP_HAVE_THREADS
+		sched_yield();
+#endif
+	}
+}
 
 typedef char const * xap_error_t;
 typedef xap_error_t (*xap_assign)(int, char **, void *, int *);
@@ -79,8 +202,10 @@ xap_error_t xap_long(int argc, char ** argv, long * target, int * consumed)
 	if (argv[0][0] == '\0') return "empty argument";
 
 	char * endptr;
-	double value = strtol(argv[0], &endptr, 10);
+	errno = 0;
+	long value = strtol(argv[0], &endptr, 10);
 	if (endptr[0] != '\0') return "not a whole number";
+	if (errno == ERANGE) return "out of range";
 	*target = value;
 	*consumed = 1;
 	return 0;
@@ -92,6 +217,10 @@ xap_error_t xap_int(int argc, char ** argv, int * target, int * consumed)
 	long tmp;
 	xap_error_t error = xap_long(argc, argv, &tmp, consumed);
 	if (error) return error;
+	if (tmp < INT_MIN || tmp > INT_MAX) {
+		*consumed = 0;
+		return "out of range";
+	}
 	*target = tmp;
 	return NULL;
 }
@@ -107,6 +236,253 @@ xap_error_t xap_float(int argc, char ** argv, float * target, int * consumed)
 }
 
 
+/* locale-independent integers
+ *
+ * an optional sign, then an optional 0x, 0o or 0b prefix, then digits, then
+ * an optional k, M, G or T (powers of 1000) or Ki, Mi, Gi or Ti (powers of
+ * 1024) suffix; e.g., -0x10, 0b101, 4Ki or 2M
+ *
+ * the _scan versions also end at sep and set *end to where they ended, so
+ * that a list of numbers can be converted in place
+ */
+static inline
+xap_error_t xap_scan_magnitude(char const * str, char sep, char const ** end, bool * negative, uint64_t * magnitude)
+{
+	*negative = str[0] == '-';
+	if (str[0] == '-' || str[0] == '+') str++;
+
+	unsigned base = 10;
+	if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) base = 16;
+	if (str[0] == '0' && (str[1] == 'o' || str[1] == 'O')) base = 8;
+	if (str[0] == '0' && (str[1] == 'b' || str[1] == 'B')) base = 2;
+	if (base != 10) str += 2;
+
+	uint64_t value = 0;
+	char const * digits = str;
+	for (;; str++) {
+		unsigned digit;
+		if (str[0] >= '0' && str[0] <= '9') digit = str[0] - '0';
+		else if (str[0] >= 'a' && str[0] <= 'f') digit = str[0] - 'a' + 10;
+		else if (str[0] >= 'A' && str[0] <= 'F') digit = str[0] - 'A' + 10;
+		else break;
+		if (digit >= base) break;
+		if (value > (UINT64_MAX - digit) / base) return "out of range";
+		value = value * base + digit;
+	}
+	if (str == digits) return "not a whole number";
+
+	uint64_t scale = 1, step = str[0] != '\0' && str[1] == 'i' ? 1024 : 1000;
+	switch (str[0]) {
+		case 'T': scale *= step; /* fall through */
+		case 'G': scale *= step; /* fall through */
+		case 'M': scale *= step; /* fall through */
+		case 'k': case 'K': scale *= step; str += 1 + (step == 1024);
+	}
+	if (str[0] != '\0' && str[0] != sep) return "not a whole number";
+	if (value > UINT64_MAX / scale) return "out of range";
+	*magnitude = value * scale;
+	*end = str;
+	return NULL;
+}
+
+static inline
+xap_error_t xap_parse_magnitude(char const * str, bool * negative, uint64_t * magnitude)
+{
+	char const * end;
+	return xap_scan_magnitude(str, '\0', &end, negative, magnitude);
+}
+
+#define xap_define_signed(name, type, min, max) \
+	static inline \
+	xap_error_t name ## _scan(char const * str, char sep, char const ** end, type * target) \
+	{ \
+		bool negative; \
+		uint64_t magnitude; \
+		xap_error_t error = xap_scan_magnitude(str, sep, end, &negative, &magnitude); \
+		if (error) return error; \
+		if (magnitude > (negative ? (uint64_t)-((min) + 1) + 1 : (uint64_t)(max))) return "out of range"; \
+		*target = negative && magnitude ? (type)(-(int64_t)(magnitude - 1) - 1) : (type)magnitude; \
+		return NULL; \
+	} \
+	\
+	static inline \
+	xap_error_t name(int argc, char ** argv, type * target, int * consumed) \
+	{ \
+		*consumed = 0; \
+		if (argc < 1) return "need another argument"; \
+		if (argv[0][0] == '\0') return "empty argument"; \
+		char const * end; \
+		xap_error_t error = name ## _scan(argv[0], '\0', &end, target); \
+		if (error) return error; \
+		*consumed = 1; \
+		return NULL; \
+	}
+
+#define xap_define_unsigned(name, type, max) \
+	static inline \
+	xap_error_t name ## _scan(char const * str, char sep, char const ** end, type * target) \
+	{ \
+		bool negative; \
+		uint64_t magnitude; \
+		xap_error_t error = xap_scan_magnitude(str, sep, end, &negative, &magnitude); \
+		if (error) return error; \
+		if ((negative && magnitude) || magnitude > (uint64_t)(max)) return "out of range"; \
+		*target = magnitude; \
+		return NULL; \
+	} \
+	\
+	static inline \
+	xap_error_t name(int argc, char ** argv, type * target, int * consumed) \
+	{ \
+		*consumed = 0; \
+		if (argc < 1) return "need another argument"; \
+		if (argv[0][0] == '\0') return "empty argument"; \
+		char const * end; \
+		xap_error_t error = name ## _scan(argv[0], '\0', &end, target); \
+		if (error) return error; \
+		*consumed = 1; \
+		return NULL; \
+	}
+
+xap_define_signed(xap_int8, int8_t, INT8_MIN, INT8_MAX)
+xap_define_signed(xap_int16, int16_t, INT16_MIN, INT16_MAX)
+xap_define_signed(xap_int32, int32_t, INT32_MIN, INT32_MAX)
+xap_define_signed(xap_int64, int64_t, INT64_MIN, INT64_MAX)
+xap_define_unsigned(xap_uint8, uint8_t, UINT8_MAX)
+xap_define_unsigned(xap_uint16, uint16_t, UINT16_MAX)
+xap_define_unsigned(xap_uint32, uint32_t, UINT32_MAX)
+xap_define_unsigned(xap_uint64, uint64_t, UINT64_MAX)
+xap_define_unsigned(xap_size, size_t, SIZE_MAX)
+
+/* locale-independent reals
+ *
+ * decimals with up to 19 significant digits and a power of ten no larger
+ * than 22 are converted exactly with one multiplication or division (this
+ * needs FLT_EVAL_METHOD == 0 to be correctly rounded); anything else (e.g.,
+ * longer mantissas, hex floats, inf, nan) falls back to strtod(), which is
+ * only locale-independent with XAP_HAVE_STRTOD_L
+ */
+static inline
+double xap_strtod(char const * str, char ** end)
+{
+#ifdef XAP_HAVE_STRTOD_L
+	static locale_t c_locale;  /* never freed */
+	static xap_once_t ready;
+	if (!xap_once_done(&ready) && xap_once_begin(&ready)) {
+		c_locale = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0);
+		xap_once_end(&ready);
+	}
+	if (xap_once_done(&ready) && c_locale != (locale_t)0) return strtod_l(str, end, c_locale);
+	locale_t own = newlocale(LC_NUMERIC_MASK, "C", (locale_t)0); /* still being created */
+	if (own != (locale_t)0) {
+		double result = strtod_l(str, end, own);
+		freelocale(own);
+		return result;
+	}
+#endif
+	return strtod(str, end);
+}
+
+static inline
+xap_error_t xap_scan_real(char const * str, char sep, char const ** end, double * value)
+{
+	static const double powers[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+	};
+	char const * p = str;
+	bool negative = p[0] == '-';
+	if (p[0] == '-' || p[0] == '+') p++;
+
+	uint64_t mantissa = 0;
+	int n_digits = 0, exponent = 0;
+	bool any = false;
+	for (; p[0] >= '0' && p[0] <= '9'; p++, any = true) {
+		if (n_digits == 0 && p[0] == '0') continue;
+		if (++n_digits <= 19) mantissa = mantissa * 10 + (p[0] - '0');
+		else exponent++;
+	}
+	if (p[0] == '.') {
+		for (p++; p[0] >= '0' && p[0] <= '9'; p++, any = true) {
+			if (n_digits == 0 && p[0] == '0') { exponent--; continue; }
+			if (++n_digits <= 19) { mantissa = mantissa * 10 + (p[0] - '0'); exponent--; }
+		}
+	}
+	if (any && (p[0] == 'e' || p[0] == 'E')) {
+		char const * e = p + 1;
+		bool e_negative = e[0] == '-';
+		if (e[0] == '-' || e[0] == '+') e++;
+		int e_value = 0;
+		char const * e_digits = e;
+		for (; e[0] >= '0' && e[0] <= '9' && e_value < 100000; e++) e_value = e_value * 10 + (e[0] - '0');
+		if (e != e_digits) {
+			exponent += e_negative ? -e_value : e_value;
+			p = e;
+		}
+	}
+
+	if (any && (p[0] == '\0' || p[0] == sep) && n_digits <= 19 && mantissa <= (UINT64_C(1) << 53)
+		&& exponent >= -22 && exponent <= 22 && FLT_EVAL_METHOD == 0) {
+		double result = (double)mantissa;
+		result = exponent < 0 ? result / powers[-exponent] : result * powers[exponent];
+		*value = negative ? -result : result;
+		*end = p;
+		return NULL;
+	}
+
+	char * endptr;
+	double result = xap_strtod(str, &endptr);
+	if (endptr == str || (endptr[0] != '\0' && endptr[0] != sep)) return "not a real number";
+	*value = result;
+	*end = endptr;
+	return NULL;
+}
+
+static inline
+xap_error_t xap_parse_real(char const * str, double * value)
+{
+	char const * end;
+	return xap_scan_real(str, '\0', &end, value);
+}
+
+static inline
+xap_error_t xap_float64_scan(char const * str, char sep, char const ** end, double * target)
+{
+	return xap_scan_real(str, sep, end, target);
+}
+
+static inline
+xap_error_t xap_float32_scan(char const * str, char sep, char const ** end, float * target)
+{
+	double tmp;
+	xap_error_t error = xap_scan_real(str, sep, end, &tmp);
+	if (error) return error;
+	*target = tmp;
+	return NULL;
+}
+
+static inline
+xap_error_t xap_float64(int argc, char ** argv, double * target, int * consumed)
+{
+	*consumed = 0;
+	if (argc < 1) return "need another argument";
+	if (argv[0][0] == '\0') return "empty argument";
+	xap_error_t error = xap_parse_real(argv[0], target);
+	if (error) return error;
+	*consumed = 1;
+	return NULL;
+}
+
+static inline
+xap_error_t xap_float32(int argc, char ** argv, float * target, int * consumed)
+{
+	double tmp;
+	xap_error_t error = xap_float64(argc, argv, &tmp, consumed);
+	if (error) return error;
+	*target = tmp;
+	return NULL;
+}
+
 static inline
 int xap_fprint_double(double d, FILE * stream) { return fprintf(stream, "%lg", d); }
 
@@ -131,6 +507,25 @@ xap_error_t xap_shift_args(int origin, int count, int * p_argc, char ** argv)
 	return NULL;
 }
 
+/* mark count arguments starting at *p_origin as consumed (NULL) and step past
+ * them; unlike xap_shift_args, this is O(count) and leaves the tail alone */
+static inline
+xap_error_t xap_mark_args(int * p_origin, int count, int argc, char ** argv)
+{
+	if (*p_origin + count > argc) return "not enough arguments for requested shift";
+	for (int end = *p_origin + count; *p_origin < end; (*p_origin)++) argv[*p_origin] = NULL;
+	return NULL;
+}
+
+/* drop the arguments marked by xap_mark_args in a single pass */
+static inline
+void xap_compact_args(int * p_argc, char ** argv)
+{
+	int n = 0;
+	for (int i = 0; i < *p_argc; i++) if (argv[i] != NULL) argv[n++] = argv[i];
+	*p_argc = n;
+}
+
 #define xap_define_repeat(name, type, func, count) \
 	static inline \
 	xap_error_t name(int argc, char ** argv, type (*target)[count], int * consumed) \
@@ -147,370 +542,3907 @@ xap_error_t xap_shift_args(int origin, int count, int * p_argc, char ** argv)
 		return NULL; \
 	}
 
-typedef struct xap_error_context {
-	xap_error_t error;
-	char * argument;
-	size_t n_parameters;
-	char ** parameters;
-} xap_error_context_t;
+/* argv writer
+ *
+ * builds an argv in a single caller-supplied buffer: the strings are packed
+ * from the front and the pointers from the back, in reverse, which
+ * xap_writer_argv() turns around once everything is written
+ */
+typedef struct xap_writer {
+	char * buffer;
+	char ** end;     /* one past the last pointer, which is NULL */
+	size_t used;     /* string bytes at the front */
+	size_t argc;     /* pointers just before end */
+	char const * option;  /* the keyword being written, NULL for positionals */
+	bool full;
+} xap_writer_t;
 
 static inline
-int xap_fprint_error_context(xap_error_context_t * ctx, FILE * stream)
+xap_writer_t xap_writer(void * buffer, size_t size)
 {
-	int cnt = 0;
-	cnt += fprintf(stream, "error: %s: %s", ctx->error, ctx->argument);
-	for (size_t i = 0; i < ctx->n_parameters; i++)
-		cnt += fprintf(stream, " %s", ctx->parameters[i]);
-	cnt += fputc('\n', stream) != EOF;
-	return cnt;
+	uintptr_t end = ((uintptr_t)buffer + size) / _Alignof(char *) * _Alignof(char *);
+	bool fits = size >= sizeof(char *) && end - sizeof(char *) >= (uintptr_t)buffer;
+	return (xap_writer_t){ .buffer = buffer, .end = fits ? (char **)end - 1 : buffer, .full = !fits };
 }
 
+/* room for a string of len characters plus its terminator and pointer */
 static inline
-ssize_t xap_find_int(size_t size, int * array, int item)
+char * xap_write_space(xap_writer_t * w, size_t len)
 {
-	for (size_t i = 0; i < size; i++) if (array[i] == item) return i;
-	return -1;
+	if (w->full) return NULL;
+	char * start = w->buffer + w->used;
+	if ((char *)(w->end - w->argc - 1) < start || (size_t)((char *)(w->end - w->argc - 1) - start) < len + 1) {
+		w->full = true;
+		return NULL;
+	}
+	w->used += len + 1;
+	w->end[-1 - (ptrdiff_t)w->argc++] = start;
+	start[len] = '\0';
+	return start;
 }
 
-#define XAP_NO_HELP ""
-#define XAP_ALREADY_PARSED 0x7FFFFFFF  /* something else is bound to break before this is a problem */
-
-/* simple transformations from arguments */
-#define xap_derive_null_char(...) \
-	'\0'
-#define xap_derive_null_char_comma(...) \
-	xap_derive_null_char(__VA_ARGS__),
+static inline
+void xap_write_arg(xap_writer_t * w, char const * arg)
+{
+	size_t len = strlen(arg);
+	char * space = xap_write_space(w, len);
+	if (space != NULL) memcpy(space, arg, len);
+}
 
-#define xap_derive_id(sopt, lopt, ...) \
-	((lopt) ? (int)(sopt) : -(int)(sopt))
-#define xap_derive_id_comma(sopt, lopt, ...) \
-	xap_derive_id(sopt, lopt, __VA_ARGS__), \
+static inline
+void xap_write_number(xap_writer_t * w, char const * format, ...)
+{
+	char tmp[64];
+	va_list ap;
+	va_start(ap, format);
+	int len = vsnprintf(tmp, sizeof(tmp), format, ap);
+	va_end(ap);
+	char * space = len >= 0 ? xap_write_space(w, len) : NULL;
+	if (space != NULL) memcpy(space, tmp, len);
+}
 
-#define xap_derive_state_name(sopt, lopt, type, name, arry, conv) \
-	SET_ ## name
-#define xap_derive_state_name_comma(sopt, lopt, type, name, arry, conv) \
-	xap_derive_state_name(sopt, lopt, type, name, arry, conv),
+/* the name of a keyword, with the long form if there is one */
+static inline
+void xap_write_option(xap_writer_t * w, int sopt, char const * lopt)
+{
+	char * space = lopt && lopt[0] ? xap_write_space(w, strlen(lopt) + 2) : xap_write_space(w, 2);
+	w->option = space;
+	if (space == NULL) return;
+	if (lopt && lopt[0]) sprintf(space, "--%s", lopt);
+	else sprintf(space, "-%c", sopt);
+}
 
-#define xap_derive_field(sopt, lopt, type, name, arry, conv) \
-	type name arry;
+/* turns everything written since w->argc was first into a single argument,
+ * with sep between the parts; the strings are next to each other already */
+static inline
+void xap_write_join(xap_writer_t * w, size_t first, char sep)
+{
+	if (w->full || w->argc <= first + 1) return;
+	char * last = w->buffer + w->used - 1;
+	for (char * p = w->end[-1 - (ptrdiff_t)first]; p < last; p++)
+		if (*p == '\0') *p = sep;
+	w->argc = first + 1;
+}
 
-#define xap_derive_disp(sopt, lopt, disp, desc) \
-	disp
-#define xap_derive_desc(sopt, lopt, disp, desc) \
-	desc
+/* the writer's argv and argc, NULL-terminated, or NULL if it ran out of room */
+static inline
+char ** xap_writer_argv(xap_writer_t * w, int * argc)
+{
+	if (w->full) return NULL;
+	char ** argv = w->end - w->argc;
+	for (size_t i = 0, j = w->argc - 1; i < j && j < w->argc; i++, j--) {
+		char * tmp = argv[i];
+		argv[i] = argv[j];
+		argv[j] = tmp;
+	}
+	*w->end = NULL;
+	*argc = w->argc;
+	return argv;
+}
 
-/* generate helpful constants */
-#define xap_count(arguments) \
-	sizeof((char[]){ arguments(xap_derive_null_char_comma) })
-#define xap_ids(arguments) \
-	{ arguments(xap_derive_id_comma) }
-#define xap_struct(arguments) \
-	{ arguments(xap_derive_field) }
+/* inverse converters
+ *
+ * conv_format(w, &field) writes the arguments that conv would turn back into
+ * the same field and returns false instead if the field is not set (so that
+ * its keyword can be left out)
+ */
+#if defined(__clang__)
+	#pragma clang diagnostic push
+	#pragma clang diagnostic ignored "-Wunused-parameter"
+#elif defined(__GNUC__)
+	#pragma GCC diagnostic push
+	#pragma GCC diagnostic ignored "-Wunused-parameter"
+#endif
 
+static inline
+bool xap_toggle_format(xap_writer_t * w, bool const * source) { return *source; }
 
-/* parser variables */
-#define xap_parser_vars(arguments, stop_after, required) \
-	bool dirty = false; \
-	int i = -1, position = 0; \
-	int consumed; \
-	char * equal_sign = NULL; \
-	size_t lopt_len; \
-	int id, ids[] = xap_ids(arguments); \
-	size_t n_ids = xap_count(arguments); \
-	xap_error_context_t ctx = { 0 };
+#if defined(__clang__)
+	#pragma clang diagnostic pop
+#elif defined(__GNUC__)
+	#pragma GCC diagnostic pop
+#endif
 
+static inline
+bool xap_string_format(xap_writer_t * w, char const * const * source)
+{
+	if (*source == NULL) return false;
+	xap_write_arg(w, *source);
+	return true;
+}
 
-/* parsing states */
-#define xap_derive_state_set_arg(sopt, lopt, type, name, arry, conv) \
-	case xap_derive_state_name(sopt, lopt, type, name, arry, conv): \
-		id = xap_derive_id(sopt, lopt); \
-		if (xap_find_int(n_ids, ids, id) < 0) { \
-			ctx.error = "already parsed"; \
-			return ctx; \
-		} \
-		ctx.error = conv(*argc - i, argv + i, &args->name, &consumed); \
-		ctx.n_parameters = consumed - (equal_sign != NULL); \
-		ctx.parameters = argv + i + (equal_sign != NULL); \
-		if (ctx.error) return ctx; \
-		dirty &= consumed == 0; \
-		ctx.error = xap_shift_args(i, consumed, argc, argv); \
-		if (ctx.error) return ctx; \
-		if (argv[i][0] == '\0' && i < *argc) { \
-			ctx.error = xap_shift_args(i, 1, argc, argv); \
-			if (ctx.error) return ctx; \
-		} \
-		ids[xap_find_int(n_ids, ids, id)] = XAP_ALREADY_PARSED; \
-		if (get_stop_after(xap_derive_id(sopt, lopt))) return ctx; \
-		state = NEXT_ARG; \
-	break;
-#define xap_states_set_arg_X(arguments) \
-	arguments(xap_derive_state_set_arg); \
+static inline
+bool xap_double_format(xap_writer_t * w, double const * source)
+{
+	xap_write_number(w, "%.17g", *source);
+	return true;
+}
+
+static inline
+bool xap_float_format(xap_writer_t * w, float const * source)
+{
+	xap_write_number(w, "%.9g", *source);
+	return true;
+}
+
+static inline
+bool xap_long_format(xap_writer_t * w, long const * source)
+{
+	xap_write_number(w, "%ld", *source);
+	return true;
+}
+
+static inline
+bool xap_int_format(xap_writer_t * w, int const * source)
+{
+	xap_write_number(w, "%d", *source);
+	return true;
+}
+
+#define xap_define_signed_format(name, type) \
+	static inline \
+	bool name ## _format(xap_writer_t * w, type const * source) \
+	{ \
+		xap_write_number(w, "%lld", (long long)*source); \
+		return true; \
+	}
+
+#define xap_define_unsigned_format(name, type) \
+	static inline \
+	bool name ## _format(xap_writer_t * w, type const * source) \
+	{ \
+		xap_write_number(w, "%llu", (unsigned long long)*source); \
+		return true; \
+	}
+
+xap_define_signed_format(xap_int8, int8_t)
+xap_define_signed_format(xap_int16, int16_t)
+xap_define_signed_format(xap_int32, int32_t)
+xap_define_signed_format(xap_int64, int64_t)
+xap_define_unsigned_format(xap_uint8, uint8_t)
+xap_define_unsigned_format(xap_uint16, uint16_t)
+xap_define_unsigned_format(xap_uint32, uint32_t)
+xap_define_unsigned_format(xap_uint64, uint64_t)
+xap_define_unsigned_format(xap_size, size_t)
+
+static inline
+bool xap_float64_format(xap_writer_t * w, double const * source) { return xap_double_format(w, source); }
+
+static inline
+bool xap_float32_format(xap_writer_t * w, float const * source) { return xap_float_format(w, source); }
+
+/* the inverse of xap_define_repeat(name, type, func, count) */
+#define xap_define_repeat_format(name, type, func, count) \
+	static inline \
+	bool name ## _format(xap_writer_t * w, type const (*source)[count]) \
+	{ \
+		for (int i = 0; i < count; i++) func ## _format(w, *source + i); \
+		return true; \
+	}
+
+/* bump allocator over a caller-supplied buffer; everything allocated from it
+ * is released at once by xap_arena_reset() */
+typedef struct xap_arena {
+	char * base;
+	size_t size;
+	size_t used;
+} xap_arena_t;
+
+static inline
+xap_arena_t xap_arena(void * buffer, size_t size)
+{
+	return (xap_arena_t){ .base = buffer, .size = size, .used = 0 };
+}
+
+static inline
+void * xap_arena_alloc(xap_arena_t * arena, size_t size, size_t align)
+{
+	size_t start = (arena->used + align - 1) / align * align;
+	if (start > arena->size || size > arena->size - start) return NULL;
+	arena->used = start + size;
+	return arena->base + start;
+}
+
+static inline
+void xap_arena_reset(xap_arena_t * arena)
+{
+	arena->used = 0;
+}
+
+/* variable-length list arguments
+ *
+ * unlike other fields, xap_list_t fields may be given more than once; the
+ * elements are stored contiguously in the arena, which has to be set before
+ * parsing, e.g., struct args args = { .includes = xap_list(&arena) };
+ */
+typedef struct xap_list {
+	void * items;
+	size_t count;
+	size_t capacity;
+	xap_arena_t * arena;
+} xap_list_t;
+
+#define xap_is_list(field) \
+	_Generic(&(field), xap_list_t *: true, default: false)
+
+static inline
+xap_list_t xap_list(xap_arena_t * arena)
+{
+	return (xap_list_t){ .arena = arena };
+}
+
+/* room for n more elements, growing in place when the list is the last thing
+ * in the arena and by doubling (or to fit n) otherwise; a list may also start out with
+ * caller-supplied items and capacity, which are used until they run out */
+static inline
+void * xap_list_extend(xap_list_t * list, size_t n, size_t size, size_t align)
+{
+	if (list->capacity - list->count < n) {
+		if (list->arena == NULL || n > SIZE_MAX / size / 2 - list->count) return NULL;
+		char * end = (char *)list->items + list->capacity * size;
+		size_t capacity = list->capacity ? 2 * list->capacity : 16;
+		if (capacity - list->count < n) capacity = list->count + n;
+		if (list->items != NULL && end == list->arena->base + list->arena->used
+			&& (capacity - list->capacity) * size <= list->arena->size - list->arena->used) {
+			list->arena->used += (capacity - list->capacity) * size;
+		}
+		else {
+			void * items = xap_arena_alloc(list->arena, capacity * size, align);
+			if (items == NULL) return NULL;
+			if (list->count) memcpy(items, list->items, list->count * size);
+			list->items = items;
+		}
+		list->capacity = capacity;
+	}
+	void * items = (char *)list->items + list->count * size;
+	list->count += n;
+	return items;
+}
+
+static inline
+void * xap_list_append(xap_list_t * list, size_t size, size_t align)
+{
+	return xap_list_extend(list, 1, size, align);
+}
+
+/* one element per occurrence, e.g., -I 1 -I 2 */
+#define xap_define_append(name, type, func) \
+	static inline \
+	xap_error_t name(int argc, char ** argv, xap_list_t * target, int * consumed) \
+	{ \
+		*consumed = 0; \
+		type * item = xap_list_append(target, sizeof(type), _Alignof(type)); \
+		if (item == NULL) return "arena is full"; \
+		xap_error_t error = func(argc, argv, item, consumed); \
+		if (error) target->count--; \
+		return error; \
+	}
+
+/* every following argument up to the next one that starts with '-', e.g.,
+ * --files a b c -x; a "--" ends the list and is consumed with it */
+#define xap_define_list(name, type, func) \
+	static inline \
+	xap_error_t name(int argc, char ** argv, xap_list_t * target, int * consumed) \
+	{ \
+		*consumed = 0; \
+		while (argc > 0 && (argv[0][0] != '-' || argv[0][1] == '\0')) { \
+			type * item = xap_list_append(target, sizeof(type), _Alignof(type)); \
+			if (item == NULL) return "arena is full"; \
+			int loc_consumed; \
+			xap_error_t error = func(argc, argv, item, &loc_consumed); \
+			if (error) { \
+				target->count--; \
+				return error; \
+			} \
+			argc -= loc_consumed; \
+			argv += loc_consumed; \
+			*consumed += loc_consumed; \
+			if (loc_consumed == 0) break; \
+		} \
+		if (argc > 0 && strcmp(argv[0], "--") == 0) *consumed += 1; \
+		return NULL; \
+	}
+
+/* the inverses of xap_define_append(name, type, func), which repeats the
+ * keyword before every element, and of xap_define_list(name, type, func),
+ * which ends the elements with "--" so that nothing after them is taken for
+ * one; elements that start with '-' cannot be written for the latter */
+#define xap_define_append_format(name, type, func) \
+	static inline \
+	bool name ## _format(xap_writer_t * w, xap_list_t const * source) \
+	{ \
+		type const * items = source->items; \
+		char const * option = w->option; \
+		for (size_t k = 0; k < source->count; k++) { \
+			if (k > 0 && option != NULL) xap_write_arg(w, option); \
+			func ## _format(w, items + k); \
+		} \
+		return source->count > 0; \
+	}
+
+#define xap_define_list_format(name, type, func) \
+	static inline \
+	bool name ## _format(xap_writer_t * w, xap_list_t const * source) \
+	{ \
+		type const * items = source->items; \
+		for (size_t k = 0; k < source->count; k++) func ## _format(w, items + k); \
+		if (source->count > 0) xap_write_arg(w, "--"); \
+		return source->count > 0; \
+	}
+
+/* delimited lists of numbers
+ *
+ * a single argument like 0.1,0.2,0.3 is converted into an xap_list_t: one
+ * pass counts the separators 16 bytes at a time, the list grows once to fit,
+ * and the elements are converted in place by func_scan (e.g., xap_int32_scan
+ * or xap_float64_scan), which stops at the separator; with threads, inputs
+ * of at least 2 * XAP_SPLIT_CHUNK bytes are cut at separators and converted
+ * on up to one thread per online CPU
+ */
+#ifndef XAP_SPLIT_CHUNK
+#define XAP_SPLIT_CHUNK (1 << 20)  /* fewest bytes worth a thread of their own */
+#endif
+
+/* how many times c occurs in [str, end) */
+static inline
+size_t xap_count_byte(char const * str, char const * end, char c)
+{
+	size_t count = 0;
+#if defined(XAP_SIMD_SSE2)
+	__m128i const needle = _mm_set1_epi8(c);
+	while (end - str >= 16) {
+		/* per-byte counts, which cannot overflow in 255 blocks */
+		__m128i sums = _mm_setzero_si128();
+		for (int k = 0; k < 255 && end - str >= 16; k++, str += 16)
+			sums = _mm_sub_epi8(sums, _mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *)str), needle));
+		sums = _mm_sad_epu8(sums, _mm_setzero_si128());
+		count += _mm_cvtsi128_si32(sums) + _mm_extract_epi16(sums, 4);
+	}
+#elif defined(XAP_SIMD_NEON)
+	uint8x16_t const needle = vdupq_n_u8(c);
+	for (; end - str >= 16; str += 16)
+		count += vaddvq_u8(vshrq_n_u8(vceqq_u8(vld1q_u8((uint8_t const *)str), needle), 7));
+#endif
+	for (; str < end; str++) count += str[0] == c;
+	return count;
+}
+
+/* converts the n elements from str on into items; on failure, sets *index to
+ * the element that failed and *at to where it starts */
+typedef xap_error_t (*xap_split_range_t)(char const * str, size_t n, void * items, size_t * index, char const ** at);
+
+typedef struct xap_split_job {
+	xap_split_range_t range;
+	char const * str;
+	size_t first;       /* index of the job's first element */
+	size_t n;
+	void * items;
+	size_t index;       /* set with error */
+	char const * at;
+	xap_error_t error;
+} xap_split_job_t;
+
+static inline
+void * xap_split_worker(void * data)
+{
+	xap_split_job_t * job = data;
+	job->error = job->range(job->str, job->n, job->items, &job->index, &job->at);
+	return NULL;
+}
+
+/* error with the element and byte it happened at, kept in the arena if there
+ * is room for it */
+static inline
+xap_error_t xap_split_error(xap_arena_t * arena, xap_error_t error, size_t index, size_t offset)
+{
+	if (arena == NULL) return error;
+	int len = snprintf(NULL, 0, "%s (element %zu at byte %zu)", error, index, offset);
+	char * message = len < 0 ? NULL : xap_arena_alloc(arena, len + 1, 1);
+	if (message == NULL) return error;
+	snprintf(message, len + 1, "%s (element %zu at byte %zu)", error, index, offset);
+	return message;
+}
+
+static inline
+xap_error_t xap_split(int argc, char ** argv, xap_list_t * target, int * consumed, char sep, size_t size, size_t align, xap_split_range_t range)
+{
+	*consumed = 0;
+	if (argc < 1) return "need another argument";
+	char const * str = argv[0], * end = str + strlen(str);
+	if (str == end) return "empty argument";
+
+	size_t n_jobs = 1;
+#ifdef XAP_HAVE_THREADS
+	if ((size_t)(end - str) >= 2 * XAP_SPLIT_CHUNK) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_jobs = (end - str) / XAP_SPLIT_CHUNK;
+		if (n_jobs > (size_t)(n_cpus > 0 ? n_cpus : 1)) n_jobs = n_cpus > 0 ? (size_t)n_cpus : 1;
+	}
+#endif
+	/* every job but the last ends at a separator */
+	xap_split_job_t jobs[n_jobs];
+	size_t n_items = 0;
+	char const * begin = str;
+	for (size_t t = 0; t < n_jobs; t++) {
+		char const * stop = end;
+		if (t + 1 < n_jobs) {
+			char const * middle = str + (end - str) / n_jobs * (t + 1);
+			if (middle < begin) middle = begin;
+			stop = memchr(middle, sep, end - middle);
+			if (stop == NULL) stop = end;
+		}
+		size_t n = xap_count_byte(begin, stop, sep) + 1;
+		jobs[t] = (xap_split_job_t){ .range = range, .str = begin, .first = n_items, .n = n };
+		n_items += n;
+		if (stop == end) n_jobs = t + 1;
+		else begin = stop + 1;
+	}
+
+	char * items = xap_list_extend(target, n_items, size, align);
+	if (items == NULL) return "arena is full";
+	for (size_t t = 0; t < n_jobs; t++) jobs[t].items = items + jobs[t].first * size;
+
+#ifdef XAP_HAVE_THREADS
+	pthread_t threads[n_jobs];
+	bool started[n_jobs];
+	for (size_t t = 1; t < n_jobs; t++) started[t] = pthread_create(threads + t, NULL, xap_split_worker, jobs + t) == 0;
+	xap_split_worker(jobs);
+	for (size_t t = 1; t < n_jobs; t++) {
+		if (started[t]) pthread_join(threads[t], NULL);
+		else xap_split_worker(jobs + t);
+	}
+#else
+	xap_split_worker(jobs);
+#endif
+
+	for (size_t t = 0; t < n_jobs; t++) {
+		if (jobs[t].error == NULL) continue;
+		target->count -= n_items;
+		return xap_split_error(target->arena, jobs[t].error, jobs[t].first + jobs[t].index, jobs[t].at - str);
+	}
+	*consumed = 1;
+	return NULL;
+}
+
+/* sep-separated values of type converted by func_scan, e.g.,
+ * xap_define_split(xap_weights, double, xap_float64, ',') for --weights 0.1,0.2;
+ * sep must not be able to appear in an element */
+#define xap_define_split(name, type, func, sep) \
+	static inline \
+	xap_error_t xap_split_range_ ## name(char const * str, size_t n, void * items, size_t * index, char const ** at) \
+	{ \
+		type * item = items; \
+		for (size_t k = 0; k < n; k++) { \
+			char const * end; \
+			xap_error_t error = str[0] == (sep) || str[0] == '\0' ? "empty element" : func ## _scan(str, (sep), &end, item + k); \
+			if (error) { \
+				*index = k; \
+				*at = str; \
+				return error; \
+			} \
+			str = end + 1; \
+		} \
+		return NULL; \
+	} \
+	\
+	static inline \
+	xap_error_t name(int argc, char ** argv, xap_list_t * target, int * consumed) \
+	{ \
+		return xap_split(argc, argv, target, consumed, (sep), sizeof(type), _Alignof(type), xap_split_range_ ## name); \
+	}
+
+/* the inverse of xap_define_split(name, type, func, sep) */
+#define xap_define_split_format(name, type, func, sep) \
+	static inline \
+	bool name ## _format(xap_writer_t * w, xap_list_t const * source) \
+	{ \
+		type const * items = source->items; \
+		size_t first = w->argc; \
+		for (size_t k = 0; k < source->count; k++) func ## _format(w, items + k); \
+		xap_write_join(w, first, (sep)); \
+		return source->count > 0; \
+	}
+
+/* lazily converted arguments
+ *
+ * an xap_lazy_t field only keeps the arguments when parsed; the converter runs
+ * on the first xap_lazy_get() (or the generated validation function) and its
+ * value is kept in the arena, which has to be set before parsing like for
+ * lists, e.g., struct args args = { .matrix = xap_lazy(&arena) };
+ */
+typedef struct xap_lazy {
+	xap_arena_t * arena;
+	xap_assign conv;        /* NULL until the argument is parsed */
+	size_t size, align;     /* of the value conv stores */
+	int argc;
+	char ** argv;           /* copies of the arguments conv will see */
+	void * value;           /* NULL until converted */
+	xap_error_t error;
+} xap_lazy_t;
+
+#define xap_is_lazy(field) \
+	_Generic(&(field), xap_lazy_t *: true, default: false)
+
+static inline
+xap_lazy_t xap_lazy(xap_arena_t * arena)
+{
+	return (xap_lazy_t){ .arena = arena };
+}
+
+static inline
+xap_error_t xap_lazy_record(int argc, char ** argv, xap_lazy_t * target, int * consumed, xap_assign conv, size_t size, size_t align, int count)
+{
+	*consumed = 0;
+	if (argc < count) return "need another argument";
+	if (target->arena == NULL) return "arena is full";
+	char ** copy = xap_arena_alloc(target->arena, count * sizeof(char *), _Alignof(char *));
+	if (copy == NULL) return "arena is full";
+	memcpy(copy, argv, count * sizeof(char *));
+	*target = (xap_lazy_t){ target->arena, conv, size, align, count, copy, NULL, NULL };
+	*consumed = count;
+	return NULL;
+}
+
+/* the converted value or NULL if the argument was not given or did not
+ * convert (then target->error says why) */
+static inline
+void * xap_lazy_value(xap_lazy_t * target)
+{
+	if (target->value != NULL || target->conv == NULL || target->error != NULL) return target->value;
+	void * value = xap_arena_alloc(target->arena, target->size, target->align);
+	if (value == NULL) {
+		target->error = "arena is full";
+		return NULL;
+	}
+	memset(value, 0, target->size);
+	int consumed;
+	target->error = target->conv(target->argc, target->argv, value, &consumed);
+	if (target->error == NULL) target->value = value;
+	return target->value;
+}
+
+#define xap_lazy_get(field, type) ((type *)xap_lazy_value(&(field)))
+
+/* given but not convertible */
+static inline
+bool xap_lazy_failed(xap_lazy_t * target)
+{
+	return target->conv != NULL && xap_lazy_value(target) == NULL;
+}
+
+/* the arguments that were kept, converted or not */
+static inline
+bool xap_lazy_format(xap_writer_t * w, xap_lazy_t const * source)
+{
+	if (source->conv == NULL) return false;
+	for (int k = 0; k < source->argc; k++) xap_write_arg(w, source->argv[k]);
+	return true;
+}
+
+/* postpone func, which takes count arguments, to the first access, e.g.,
+ * xap_define_lazy(xap_lazy_int_1000, int[1000], xap_int_1000, 1000); this
+ * defines name_format as well */
+#define xap_define_lazy(name, type, func, count) \
+	static inline \
+	xap_error_t name(int argc, char ** argv, xap_lazy_t * target, int * consumed) \
+	{ \
+		return xap_lazy_record(argc, argv, target, consumed, (xap_assign)(void (*)(void))func, sizeof(type), _Alignof(type), count); \
+	} \
+	\
+	static inline \
+	bool name ## _format(xap_writer_t * w, xap_lazy_t const * source) \
+	{ \
+		return xap_lazy_format(w, source); \
+	}
+
+/* the remaining arguments
+ *
+ * parsing stops at an xap_rest_t field, which then holds everything after it
+ * as a slice of the parser's argv instead of leaving it as leftovers, e.g.,
+ * _( 1 , NULL, xap_rest_t, command, , xap_rest) for a command to run
+ */
+typedef struct xap_rest {
+	int argc;
+	char ** argv;
+} xap_rest_t;
+
+#define xap_is_rest(field) \
+	_Generic(&(field), xap_rest_t *: true, xap_rest_t const *: true, default: false)
+
+/* the parsers fill in the slice themselves; this only serves other callers */
+static inline
+xap_error_t xap_rest(int argc, char ** argv, xap_rest_t * target, int * consumed)
+{
+	*target = (xap_rest_t){ argc, argv };
+	*consumed = 0;
+	return NULL;
+}
+
+static inline
+bool xap_rest_format(xap_writer_t * w, xap_rest_t const * source)
+{
+	for (int k = 0; k < source->argc; k++) xap_write_arg(w, source->argv[k]);
+	return source->argc > 0;
+}
+
+typedef struct xap_error_context {
+	xap_error_t error;
+	char * argument;
+	size_t n_parameters;
+	char ** parameters;
+} xap_error_context_t;
+
+static inline
+int xap_fprint_error_context(xap_error_context_t * ctx, FILE * stream)
+{
+	int cnt = 0;
+	cnt += fprintf(stream, "error: %s: %s", ctx->error, ctx->argument);
+	for (size_t i = 0; i < ctx->n_parameters; i++)
+		cnt += fprintf(stream, " %s", ctx->parameters[i]);
+	cnt += fputc('\n', stream) != EOF;
+	return cnt;
+}
+
+static inline
+ssize_t xap_find_int(size_t size, int * array, int item)
+{
+	for (size_t i = 0; i < size; i++) if (array[i] == item) return i;
+	return -1;
+}
+
+/* instrumentation
+ *
+ * with XAP_INSTRUMENT defined, each parser counts how often it enters each
+ * state, how many arguments it marks and how many bytes compacting argv moves,
+ * and times every converter call; xap_get_stats_<name>() (or table()->stats)
+ * leads to the counters and to an optional trace function that sees every
+ * transition. Otherwise, xap_instrument() drops its argument and none of this
+ * exists.
+ */
+#ifdef XAP_INSTRUMENT
+#define xap_instrument(...) __VA_ARGS__
+
+#ifdef XAP_HAVE_ATOMICS
+typedef _Atomic uint64_t xap_counter_t;
+#define xap_counter_add(counter, n) atomic_fetch_add_explicit(&(counter), (n), memory_order_relaxed)
+#define xap_counter_get(counter) atomic_load_explicit(&(counter), memory_order_relaxed)
+#else
+typedef uint64_t xap_counter_t;  /* not thread-safe without C11 atomics */
+#define xap_counter_add(counter, n) ((counter) += (n))
+#define xap_counter_get(counter) (counter)
+#endif
+
+/* the states after the per-argument ones, in the order of xap_parser_fsm */
+enum xap_step { XAP_STEP_NEXT_ARG, XAP_STEP_POSITIONAL, XAP_STEP_SOPT, XAP_STEP_LOPT, XAP_STEP_CHECK, XAP_N_STEPS };
+static char const * const xap_step_names[XAP_N_STEPS] = { "NEXT_ARG", "POSITIONAL", "SOPT", "LOPT", "CHECK" };
+
+typedef struct xap_stats xap_stats_t;
+
+/* called on entering state, with argv[i] or NULL if i is out of range */
+typedef void (*xap_trace_t)(void * data, xap_stats_t const * stats, size_t state, int i, char const * arg);
+
+struct xap_stats {
+	char const * parser;
+	size_t n_states;              /* the first step; states below it set fields */
+	char const * const * names;   /* of the fields, by state */
+	xap_counter_t * transitions;  /* by state, then by step */
+	xap_counter_t * conv_ns;      /* by state */
+	xap_counter_t parses, marked, compactions, moved_bytes;
+	xap_trace_t trace;
+	void * trace_data;
+};
+
+#define xap_derive_stats_name(sopt, lopt, type, name, arry, conv) \
+	[xap_derive_state_name(sopt, lopt, type, name, arry, conv)] = #name,
+
+/* counters for a parser whose enum state is in scope */
+#define xap_stats_vars(parser_name, arguments) \
+	static char const * const stats_names[NEXT_ARG] = { arguments(xap_derive_stats_name) }; \
+	static xap_counter_t stats_transitions[NEXT_ARG + XAP_N_STEPS], stats_conv_ns[NEXT_ARG]; \
+	static xap_stats_t stats_data = { \
+		.parser = parser_name, \
+		.n_states = NEXT_ARG, \
+		.names = stats_names, \
+		.transitions = stats_transitions, \
+		.conv_ns = stats_conv_ns, \
+	};
+
+static inline
+char const * xap_stats_state_name(xap_stats_t const * stats, size_t state)
+{
+	if (state == 0) return "UNKNOWN";
+	if (state < stats->n_states) return stats->names[state];
+	return xap_step_names[state - stats->n_states];
+}
+
+static inline
+uint64_t xap_now_ns(void)
+{
+	struct timespec t;
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &t);
+#else
+	timespec_get(&t, TIME_UTC);
+#endif
+	return (uint64_t)t.tv_sec * 1000000000u + t.tv_nsec;
+}
+
+static inline
+void xap_stats_state(xap_stats_t * stats, size_t state, int i, int argc, char ** argv)
+{
+	xap_counter_add(stats->transitions[state], 1);
+	if (stats->trace) stats->trace(stats->trace_data, stats, state, i, i >= 0 && i < argc ? argv[i] : NULL);
+}
+
+/* call before xap_compact_args() */
+static inline
+void xap_stats_compact(xap_stats_t * stats, int n_marked, int argc, char ** argv)
+{
+	uint64_t moved = 0;
+	for (int i = 0, n = 0; i < argc; i++) if (argv[i] != NULL) moved += n++ != i;
+	xap_counter_add(stats->marked, n_marked);
+	xap_counter_add(stats->compactions, 1);
+	xap_counter_add(stats->moved_bytes, moved * sizeof(char *));
+}
+
+/* one line of JSON; states that were never entered are left out */
+static inline
+void xap_fprint_stats(xap_stats_t const * stats, FILE * stream)
+{
+	fprintf(stream, "{\"parser\":\"%s\",\"parses\":%llu,\"marked\":%llu,\"compactions\":%llu,\"moved_bytes\":%llu,\"states\":[",
+		stats->parser,
+		(unsigned long long)xap_counter_get(stats->parses),
+		(unsigned long long)xap_counter_get(stats->marked),
+		(unsigned long long)xap_counter_get(stats->compactions),
+		(unsigned long long)xap_counter_get(stats->moved_bytes));
+	char const * separator = "";
+	for (size_t state = 1; state < stats->n_states + XAP_N_STEPS; state++) {
+		uint64_t transitions = xap_counter_get(stats->transitions[state]);
+		if (transitions == 0) continue;
+		fprintf(stream, "%s{\"state\":\"%s\",\"transitions\":%llu", separator,
+			xap_stats_state_name(stats, state), (unsigned long long)transitions);
+		if (state < stats->n_states)
+			fprintf(stream, ",\"conv_ns\":%llu", (unsigned long long)xap_counter_get(stats->conv_ns[state]));
+		fputc('}', stream);
+		separator = ",";
+	}
+	fputs("]}\n", stream);
+}
+#else
+#define xap_instrument(...)
+#endif
+
+/* the length of the name in a long option (arg in --arg or --arg=value) */
+static inline
+size_t xap_lopt_length(char const * arg)
+{
+	return strcspn(arg, "=");
+}
+
+/* argument classification
+ *
+ * the parsers take the kind of an argument, and for long options the length
+ * of the name, from xap_classify(); by default, it looks at argv[i] when the
+ * parser gets to it, but with XAP_CLASSIFY_BLOCK defined as, say, 64, it
+ * classifies argv[i] and the 63 arguments after it in one go into a side
+ * array, which the parser then reads instead of the strings
+ *
+ * names are scanned for '=' only up to the terminator that strlen() finds, so
+ * the vector loops never read past the end of an argument
+ */
+#ifndef XAP_CLASSIFY_BLOCK
+#define XAP_CLASSIFY_BLOCK 1
+#endif
+
+enum {
+	XAP_ARG_POSITIONAL,  /* x or - */
+	XAP_ARG_SOPT,        /* -x... */
+	XAP_ARG_LOPT,        /* --x... */
+	XAP_ARG_END,         /* -- */
+};
+
+typedef struct xap_arg_class {
+	char const * arg;    /* argv[i] when it was classified */
+	uint32_t length;     /* of the name in --name or --name=value */
+	uint8_t kind;
+} xap_arg_class_t;
+
+typedef struct xap_arg_classes {
+	int first, count;    /* argv[first] up to argv[first + count] */
+	xap_arg_class_t at[XAP_CLASSIFY_BLOCK];
+} xap_arg_classes_t;
+
+/* the first '=' in [str, str + len), or len if there is none */
+typedef size_t (*xap_find_equal_t)(char const * str, size_t len);
+
+static inline
+size_t xap_find_equal_scalar(char const * str, size_t len)
+{
+	char const * equal = memchr(str, '=', len);
+	return equal ? (size_t)(equal - str) : len;
+}
+
+#if defined(XAP_SIMD_SSE2)
+static inline
+size_t xap_find_equal_sse2(char const * str, size_t len)
+{
+	__m128i const equal = _mm_set1_epi8('=');
+	size_t k = 0;
+	for (; k + 16 <= len; k += 16) {
+		unsigned mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((__m128i const *)(str + k)), equal));
+		if (mask) return k + __builtin_ctz(mask);
+	}
+	for (; k < len; k++) if (str[k] == '=') return k;
+	return len;
+}
+#endif
+
+#if defined(XAP_SIMD_AVX2)
+__attribute__((target("avx2")))
+static inline
+size_t xap_find_equal_avx2(char const * str, size_t len)
+{
+	__m256i const equal = _mm256_set1_epi8('=');
+	size_t k = 0;
+	for (; k + 32 <= len; k += 32) {
+		unsigned mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((__m256i const *)(str + k)), equal));
+		if (mask) return k + __builtin_ctz(mask);
+	}
+	return k + xap_find_equal_sse2(str + k, len - k);
+}
+#endif
+
+#if defined(XAP_SIMD_NEON)
+static inline
+size_t xap_find_equal_neon(char const * str, size_t len)
+{
+	uint8x16_t const equal = vdupq_n_u8('=');
+	size_t k = 0;
+	for (; k + 16 <= len; k += 16) {
+		uint8x16_t hits = vceqq_u8(vld1q_u8((uint8_t const *)str + k), equal);
+		/* 4 bits per byte */
+		uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0);
+		if (mask) return k + __builtin_ctzll(mask) / 4;
+	}
+	for (; k < len; k++) if (str[k] == '=') return k;
+	return len;
+}
+#endif
+
+/* the length of the name in --name or --name=value, given name, with the
+ * best xap_find_equal_*() for the CPU the program runs on; kept out of line
+ * so that the parsers' own loops stay small */
+#if defined(__GNUC__)
+__attribute__((noinline, unused)) static
+#else
+static inline
+#endif
+uint32_t xap_lopt_name_length(char const * name)
+{
+	size_t len = strlen(name);
+#if defined(XAP_SIMD_AVX2)
+	if (len >= 32 && __builtin_cpu_supports("avx2")) return (uint32_t)xap_find_equal_avx2(name, len);
+#endif
+#if defined(XAP_SIMD_SSE2)
+	return (uint32_t)xap_find_equal_sse2(name, len);
+#elif defined(XAP_SIMD_NEON)
+	return (uint32_t)xap_find_equal_neon(name, len);
+#else
+	return (uint32_t)xap_find_equal_scalar(name, len);
+#endif
+}
+
+static inline
+void xap_classify_arg(xap_arg_class_t * out, char const * arg)
+{
+	out->arg = arg;
+	out->length = 0;
+	if (arg[0] != '-' || arg[1] == '\0') out->kind = XAP_ARG_POSITIONAL;
+	else if (arg[1] != '-') out->kind = XAP_ARG_SOPT;
+	else if (arg[2] == '\0') out->kind = XAP_ARG_END;
+	else {
+		out->kind = XAP_ARG_LOPT;
+		out->length = xap_lopt_name_length(arg + 2);
+	}
+}
+
+#if XAP_CLASSIFY_BLOCK > 1
+/* classifies argv[i] and up to XAP_CLASSIFY_BLOCK - 1 arguments after it */
+#if defined(__GNUC__)
+__attribute__((noinline, unused)) static
+#else
+static inline
+#endif
+xap_arg_class_t const * xap_classify_block(xap_arg_classes_t * classes, int argc, char ** argv, int i)
+{
+	int count = argc - i < XAP_CLASSIFY_BLOCK ? argc - i : XAP_CLASSIFY_BLOCK;
+	for (int k = 0; k < count; k++) xap_classify_arg(classes->at + k, argv[i + k]);
+	classes->first = i;
+	classes->count = count;
+	return classes->at;
+}
+
+/* the class of argv[i], from classes if it is there; a parser may have moved
+ * argv[i] on since (e.g., to the value in --x=value), in which case it, and
+ * the ones after it, are classified again */
+static inline
+xap_arg_class_t const * xap_classify(xap_arg_classes_t * classes, int argc, char ** argv, int i)
+{
+	unsigned k = (unsigned)(i - classes->first);
+	if (k < (unsigned)classes->count && classes->at[k].arg == argv[i]) return classes->at + k;
+	return xap_classify_block(classes, argc, argv, i);
+}
+#else
+static inline
+xap_arg_class_t const * xap_classify(xap_arg_classes_t * classes, int argc, char ** argv, int i)
+{
+	(void)argc;
+	xap_classify_arg(classes->at, argv[i]);
+	return classes->at;
+}
+#endif
+
+/* long option lookup
+ *
+ * names[state] holds the long option that leads to that parser state (NULL
+ * or "" if none); the index sorts the states by name so that lookups are
+ * exact binary searches and unique prefixes can be found with the same table
+ */
+typedef struct xap_lopt_index {
+	xap_once_t ready;
+	size_t n;
+	unsigned short * sorted;
+} xap_lopt_index_t;
+
+/* compare a NUL-terminated name with the first len characters of key */
+static inline
+int xap_lopt_cmp(char const * name, char const * key, size_t len)
+{
+	int cmp = strncmp(name, key, len);
+	return cmp ? cmp : name[len] != '\0';
+}
+
+static inline
+void xap_build_lopt_index(xap_lopt_index_t * index, char const * const * names, size_t n_names)
+{
+	size_t n = 0;
+	for (size_t state = 0; state < n_names; state++) {
+		if (names[state] == NULL || names[state][0] == '\0') continue;
+		size_t k = n++;
+		for (; k > 0 && strcmp(names[index->sorted[k - 1]], names[state]) > 0; k--)
+			index->sorted[k] = index->sorted[k - 1];
+		index->sorted[k] = state;
+	}
+	index->n = n;
+}
+
+/* builds the index if nobody has yet; false while another thread is at it */
+static inline
+bool xap_lopt_ready(xap_lopt_index_t * index, char const * const * names, size_t n_names)
+{
+	if (xap_once_done(&index->ready)) return true;
+	if (!xap_once_begin(&index->ready)) return false;
+	xap_build_lopt_index(index, names, n_names);
+	xap_once_end(&index->ready);
+	return true;
+}
+
+/* returns the state for key[0:len], 0 if unknown or -1 if ambiguous; an
+ * empty key is never taken as an abbreviation */
+static inline
+int xap_find_lopt(xap_lopt_index_t * index, char const * const * names, size_t n_names, char const * key, size_t len, bool abbreviate)
+{
+	if (!xap_lopt_ready(index, names, n_names)) {
+		int found = 0;
+		for (size_t state = 0; state < n_names; state++) {
+			if (names[state] == NULL || names[state][0] == '\0') continue;
+			if (xap_lopt_cmp(names[state], key, len) == 0) return state;
+			if (abbreviate && len != 0 && strncmp(names[state], key, len) == 0) found = found ? -1 : (int)state;
+		}
+		return found;
+	}
+
+	size_t lo = 0, hi = index->n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (xap_lopt_cmp(names[index->sorted[mid]], key, len) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	if (lo == index->n) return 0;
+	char const * name = names[index->sorted[lo]];
+	if (xap_lopt_cmp(name, key, len) == 0) return index->sorted[lo];
+	if (!abbreviate || len == 0 || strncmp(name, key, len) != 0) return 0;
+	if (lo + 1 < index->n && strncmp(names[index->sorted[lo + 1]], key, len) == 0) return -1;
+	return index->sorted[lo];
+}
+
+/* choice lookup
+ *
+ * the strings of a fixed set of choices are placed in a collision-free hash
+ * table when it is first used: every string hashes to a bucket, each bucket
+ * gets a displacement that sends its strings to free slots, so a lookup is
+ * one hash, one slot and one strcmp
+ */
+typedef struct xap_choice_index {
+	xap_once_t ready;
+	size_t n_slots;                  /* a power of two, or 0 to scan */
+	size_t n_buckets;                /* a power of two */
+	unsigned short * slots;          /* choice + 1, or 0 if free */
+	unsigned short * displacements;  /* one per bucket */
+} xap_choice_index_t;
+
+static inline
+uint64_t xap_choice_hash(char const * key)
+{
+	uint64_t hash = 0xcbf29ce484222325u;
+	for (; *key; key++) hash = (hash ^ (unsigned char)*key) * 0x100000001b3u;
+	return hash;
+}
+
+static inline
+size_t xap_choice_slot(xap_choice_index_t const * index, uint64_t hash, unsigned displacement)
+{
+	uint32_t slot = (uint32_t)hash ^ displacement * 0x9e3779b9u;
+	slot ^= slot >> 16;
+	slot *= 0x85ebca6bu;
+	slot ^= slot >> 13;
+	return slot & (index->n_slots - 1);
+}
+
+/* slots needs room for 4 * n_names and displacements for n_names */
+static inline
+void xap_build_choice_index(xap_choice_index_t * index, char const * const * names, size_t n_names)
+{
+	size_t n_slots = 1, n_buckets = 1;
+	while (n_slots < 2 * n_names) n_slots *= 2;
+	while (n_buckets < n_names / 2) n_buckets *= 2;
+	index->n_slots = n_slots;
+	index->n_buckets = n_buckets;
+	memset(index->slots, 0, n_slots * sizeof(*index->slots));
+	memset(index->displacements, 0, n_buckets * sizeof(*index->displacements));
+
+	uint64_t hashes[n_names];
+	size_t sizes[n_buckets], placed[n_names];
+	memset(sizes, 0, sizeof(sizes));
+	for (size_t k = 0; k < n_names; k++) {
+		hashes[k] = xap_choice_hash(names[k]);
+		sizes[hashes[k] >> 40 & (n_buckets - 1)]++;
+	}
+
+	/* the fullest buckets go first, while most slots are still free */
+	for (size_t size = n_names; size > 0; size--) {
+		for (size_t bucket = 0; bucket < n_buckets; bucket++) {
+			if (sizes[bucket] != size) continue;
+			unsigned displacement = 0;
+			for (; displacement <= USHRT_MAX; displacement++) {
+				size_t n_placed = 0;
+				for (size_t k = 0; k < n_names; k++) {
+					if ((hashes[k] >> 40 & (n_buckets - 1)) != bucket) continue;
+					size_t slot = xap_choice_slot(index, hashes[k], displacement);
+					if (index->slots[slot]) break;
+					index->slots[slot] = k + 1;
+					placed[n_placed++] = slot;
+				}
+				if (n_placed == size) break;
+				while (n_placed) index->slots[placed[--n_placed]] = 0;
+			}
+			if (displacement > USHRT_MAX) {
+				index->n_slots = 0;
+				return;
+			}
+			index->displacements[bucket] = displacement;
+		}
+	}
+}
+
+/* returns the position of key among the names or -1 */
+static inline
+int xap_find_choice(xap_choice_index_t * index, char const * const * names, size_t n_names, char const * key)
+{
+	if (!xap_once_done(&index->ready)) {
+		if (xap_once_begin(&index->ready)) {
+			xap_build_choice_index(index, names, n_names);
+			xap_once_end(&index->ready);
+		}
+		else {
+			for (size_t k = 0; k < n_names; k++) if (strcmp(names[k], key) == 0) return k;
+			return -1;
+		}
+	}
+	if (index->n_slots == 0) {
+		for (size_t k = 0; k < n_names; k++) if (strcmp(names[k], key) == 0) return k;
+		return -1;
+	}
+
+	uint64_t hash = xap_choice_hash(key);
+	unsigned displacement = index->displacements[hash >> 40 & (index->n_buckets - 1)];
+	unsigned k = index->slots[xap_choice_slot(index, hash, displacement)];
+	return k && strcmp(names[k - 1], key) == 0 ? (int)k - 1 : -1;
+}
+
+#define xap_derive_choice_value(value, string) value,
+#define xap_derive_choice_string(value, string) string,
+#define xap_derive_choice_list(value, string) "|" string
+
+/* "a|b|c" for choices(_) = _(A, "a") _(B, "b") _(C, "c"), e.g., as a display hint */
+#define xap_choice_names(choices) (choices(xap_derive_choice_list) + 1)
+
+/* converter (and its inverse) from the strings of choices(_) to enum_type */
+#define xap_define_choice(name, enum_type, choices) \
+	static char const * const xap_choice_strings_ ## name[] = { choices(xap_derive_choice_string) }; \
+	static enum_type const xap_choice_values_ ## name[] = { choices(xap_derive_choice_value) }; \
+	\
+	static inline \
+	xap_error_t name(int argc, char ** argv, enum_type * target, int * consumed) \
+	{ \
+		enum { n = sizeof(xap_choice_strings_ ## name) / sizeof(*xap_choice_strings_ ## name) }; \
+		static unsigned short slots[4 * n], displacements[n]; \
+		static xap_choice_index_t index = { .slots = slots, .displacements = displacements }; \
+		*consumed = 0; \
+		if (argc < 1) return "need another argument"; \
+		int k = xap_find_choice(&index, xap_choice_strings_ ## name, n, argv[0]); \
+		if (k < 0) return "not one of the choices"; \
+		*target = xap_choice_values_ ## name[k]; \
+		*consumed = 1; \
+		return NULL; \
+	} \
+	\
+	static inline \
+	bool name ## _format(xap_writer_t * w, enum_type const * source) \
+	{ \
+		enum { n = sizeof(xap_choice_strings_ ## name) / sizeof(*xap_choice_strings_ ## name) }; \
+		for (size_t k = 0; k < n; k++) { \
+			if (xap_choice_values_ ## name[k] != *source) continue; \
+			xap_write_arg(w, xap_choice_strings_ ## name[k]); \
+			return true; \
+		} \
+		return false; \
+	}
+
+/* fixed-size bitsets, used to track arguments by their parser state */
+typedef unsigned long xap_bits_t;
+
+#define XAP_BITS_PER_WORD (8 * sizeof(xap_bits_t))
+#define xap_bits_words(n) (((n) + XAP_BITS_PER_WORD - 1) / XAP_BITS_PER_WORD)
+
+static inline
+bool xap_bit_test(xap_bits_t const * bits, size_t n)
+{
+	return bits[n / XAP_BITS_PER_WORD] >> (n % XAP_BITS_PER_WORD) & 1;
+}
+
+static inline
+void xap_bit_set(xap_bits_t * bits, size_t n)
+{
+	bits[n / XAP_BITS_PER_WORD] |= (xap_bits_t)1 << (n % XAP_BITS_PER_WORD);
+}
+
+/* set the bit of every state whose id is listed in ids (state 0 is never an
+ * argument, so it is skipped) */
+static inline
+void xap_set_bits_by_id(xap_bits_t * bits, int const * state_ids, size_t n_states, int const * ids, size_t n_ids)
+{
+	for (size_t k = 0; k < n_ids; k++)
+		for (size_t state = 1; state < n_states; state++)
+			if (state_ids[state] == ids[k]) xap_bit_set(bits, state);
+}
+
+/* the first bit set in mask but not in bits, or 0 if there is none */
+static inline
+size_t xap_first_missing_bit(xap_bits_t const * mask, xap_bits_t const * bits, size_t n_words)
+{
+	for (size_t w = 0; w < n_words; w++) {
+		xap_bits_t missing = mask[w] & ~bits[w];
+		if (missing == 0) continue;
+		size_t n = w * XAP_BITS_PER_WORD;
+		while (!(missing & 1)) missing >>= 1, n++;
+		return n;
+	}
+	return 0;
+}
+
+#define XAP_NO_HELP ""
+#define XAP_ALREADY_PARSED 0x7FFFFFFF  /* something else is bound to break before this is a problem */
+
+/* simple transformations from arguments */
+#define xap_derive_null_char(...) \
+	'\0'
+#define xap_derive_null_char_comma(...) \
+	xap_derive_null_char(__VA_ARGS__),
+
+#define xap_derive_id(sopt, lopt, ...) \
+	((lopt) ? (int)(sopt) : -(int)(sopt))
+#define xap_derive_is_keyword(sopt, lopt, ...) \
+	_Generic((lopt), char *: 1, char const *: 1, default: 0)
+
+/* keywords whose short form is XAP_LONG_ONLY or more (e.g., XAP_LONG_ONLY + 3)
+ * can only be given in their long form */
+#define XAP_LONG_ONLY 256
+#define xap_has_sopt(id) \
+	((id) > 0 && (id) < XAP_LONG_ONLY)
+#define xap_derive_has_sopt(sopt, lopt, ...) \
+	(xap_derive_is_keyword(sopt, lopt) && xap_has_sopt((int)(sopt)))
+
+#define xap_derive_id_comma(sopt, lopt, ...) \
+	xap_derive_id(sopt, lopt, __VA_ARGS__), \
+
+#define xap_derive_state_name(sopt, lopt, type, name, arry, conv) \
+	SET_ ## name
+#define xap_derive_state_name_comma(sopt, lopt, type, name, arry, conv) \
+	xap_derive_state_name(sopt, lopt, type, name, arry, conv),
+
+#define xap_derive_field(sopt, lopt, type, name, arry, conv) \
+	type name arry;
+
+#define xap_derive_disp(sopt, lopt, disp, desc) \
+	disp
+#define xap_derive_desc(sopt, lopt, disp, desc) \
+	desc
+
+/* generate helpful constants */
+#define xap_count(arguments) \
+	sizeof((char[]){ arguments(xap_derive_null_char_comma) })
+#define xap_ids(arguments) \
+	{ arguments(xap_derive_id_comma) }
+#define xap_struct(arguments) \
+	{ arguments(xap_derive_field) }
+
+
+/* parser variables */
+#define xap_parser_vars(arguments, stop_after, required) \
+	bool dirty = false; \
+	int i = -1, position = 0, current = -1; \
+	int consumed; \
+	char * equal_sign = NULL; \
+	size_t lopt_len = 0; \
+	xap_arg_classes_t classes; \
+	xap_arg_class_t const * arg_class; \
+	classes.first = classes.count = 0; \
+	int found; \
+	int n_marked = 0; \
+	xap_rest_t * rest = NULL; \
+	int rest_start = 0; \
+	xap_error_context_t ctx = { 0 };
+
+/* consumed arguments are only marked while parsing; every exit compacts argv
+ * once, so the whole parse is linear in *argc, and then splits off the rest */
+#define xap_parser_return() \
+	do { \
+		xap_instrument(xap_stats_compact(stats, n_marked, *argc, argv)); \
+		xap_compact_args(argc, argv); \
+		if (rest != NULL) { \
+			*rest = (xap_rest_t){ *argc - rest_start, argv + rest_start }; \
+			*argc = rest_start; \
+		} \
+		return ctx; \
+	} while (0)
+
+#define xap_parser_mark(count) \
+	do { \
+		ctx.error = xap_mark_args(&i, (count), *argc, argv); \
+		if (ctx.error) xap_parser_return(); \
+		n_marked += (count); \
+	} while (0)
+
+
+/* parsing states */
+#define xap_derive_state_set_arg(sopt, lopt, type, name, arry, conv) \
+	case xap_derive_state_name(sopt, lopt, type, name, arry, conv): \
+		if (!xap_is_list(args->name) && xap_bit_test(parsed, xap_derive_state_name(sopt, lopt, type, name, arry, conv))) { \
+			ctx.error = "already parsed"; \
+			xap_parser_return(); \
+		} \
+		if (xap_is_rest(args->name)) { \
+			/* the "" left of -x when it ends argv is not part of the rest */ \
+			if (equal_sign == NULL && i == current && i < *argc && argv[i][0] == '\0') xap_parser_mark(1); \
+			rest = (xap_rest_t *)(void *)&args->name; \
+			rest_start = i - n_marked; \
+			xap_bit_set(parsed, xap_derive_state_name(sopt, lopt, type, name, arry, conv)); \
+			state = CHECK; \
+			break; \
+		} \
+		xap_instrument(conv_start = xap_now_ns()); \
+		ctx.error = conv(*argc - i, argv + i, &args->name, &consumed); \
+		xap_instrument(xap_counter_add(stats->conv_ns[state], xap_now_ns() - conv_start)); \
+		ctx.n_parameters = consumed > 0 ? consumed - (equal_sign != NULL) : 0; \
+		/* argv + i lands here once the marked arguments are compacted */ \
+		ctx.parameters = argv + i - n_marked + (equal_sign != NULL); \
+		if (ctx.error) xap_parser_return(); \
+		dirty &= consumed == 0; \
+		xap_parser_mark(consumed); \
+		/* what is left of -x or --x= but not an empty argument after it */ \
+		if (consumed == 0 && i == current && i < *argc && argv[i][0] == '\0') xap_parser_mark(1); \
+		xap_bit_set(parsed, xap_derive_state_name(sopt, lopt, type, name, arry, conv)); \
+		if (xap_bit_test(stop_after_mask, xap_derive_state_name(sopt, lopt, type, name, arry, conv))) \
+			xap_parser_return(); \
+		state = NEXT_ARG; \
+	break;
+#define xap_states_set_arg_X(arguments) \
+	arguments(xap_derive_state_set_arg); \
 
 #define xap_state_next_arg() \
 	case NEXT_ARG: \
 		if (dirty && i >= 0 && argv[i][0] != '\0') { state = SOPT; break; } /* y or z in -xyz */ \
 		if (*argc == i) { state = CHECK; break; } /* no more arguments */ \
 		if (i < 0) i = 0; \
+		current = i; \
 		equal_sign = NULL; \
 		ctx.argument = argv[i]; \
 		ctx.n_parameters = 0; \
 		dirty = false; \
-		if (argv[i][0] != '-' || argv[i][1] == '\0') { state = POSITIONAL; break; } /* not a keyword */ \
+		arg_class = xap_classify(&classes, *argc, argv, i); \
+		if (arg_class->kind == XAP_ARG_POSITIONAL) { state = POSITIONAL; break; } /* not a keyword */ \
 		argv[i]++; \
-		if (argv[i][0] != '-') { state = SOPT; break; } /* x in -xyz */ \
+		if (arg_class->kind == XAP_ARG_SOPT) { state = SOPT; break; } /* x in -xyz */ \
 		argv[i]++; \
-		if (argv[i][0] != '\0') { state = LOPT; break; } /* arg in --arg */ \
+		lopt_len = arg_class->length; \
+		if (arg_class->kind == XAP_ARG_LOPT) { state = LOPT; break; } /* arg in --arg */ \
 		/* "--" means do not touch other arguments */ \
 		argv[i] = ctx.argument; \
 		state = CHECK; \
 	break;
 
-#define xap_derive_sopt_test(sopt, lopt, type, name, arry, conv) \
-	else if (argv[i][0] == sopt) { \
-		state = xap_derive_state_name(sopt, lopt, type, name, arry, conv); \
-	}
-#define xap_state_sopt(arguments) \
-	case SOPT: \
-		if (0) { } \
-		arguments(xap_derive_sopt_test) \
-		else { \
-			argv[i] = ctx.argument; \
-			i++; \
-			state = NEXT_ARG; \
-			break; \
-		} \
-		argv[i]++; \
-		dirty = argv[i][0] != '\0'; \
-		if (!dirty && i != *argc - 1) { \
-			ctx.error = xap_shift_args(i, 1, argc, argv); \
-			if (ctx.error) return ctx; \
-		} \
-	break;
+/* short options are looked up in a 256-entry table indexed by the character;
+ * positionals all land on [0] (never a short option) and map to UNKNOWN */
+#define xap_derive_sopt_state(sopt, lopt, type, name, arry, conv) \
+	[xap_derive_has_sopt(sopt, lopt) ? (unsigned char)(sopt) : 0] = \
+		xap_derive_has_sopt(sopt, lopt) ? xap_derive_state_name(sopt, lopt, type, name, arry, conv) : UNKNOWN,
+#define xap_sopt_table(arguments) \
+	_Pragma("GCC diagnostic push") \
+	_Pragma("GCC diagnostic ignored \"-Woverride-init\"") \
+	static const unsigned short sopt_states[256] = { arguments(xap_derive_sopt_state) }; \
+	_Pragma("GCC diagnostic pop")
+
+#define xap_state_sopt(arguments) \
+	case SOPT: \
+		state = sopt_states[(unsigned char)argv[i][0]]; \
+		if (state == UNKNOWN) { \
+			argv[i] = ctx.argument; \
+			i++; \
+			dirty = false; \
+			state = NEXT_ARG; \
+			break; \
+		} \
+		argv[i]++; \
+		dirty = argv[i][0] != '\0'; \
+		if (!dirty && i != *argc - 1) xap_parser_mark(1); \
+	break;
+
+/* long options are found through a per-parser name table indexed by state */
+#define xap_derive_lopt_name(sopt, lopt, type, name, arry, conv) \
+	[xap_derive_state_name(sopt, lopt, type, name, arry, conv)] = xap_derive_is_keyword(sopt, lopt) ? lopt : NULL,
+#define xap_lopt_table(arguments) \
+	static char const * const lopt_names[NEXT_ARG] = { arguments(xap_derive_lopt_name) }; \
+	static unsigned short lopt_sorted[NEXT_ARG]; \
+	static xap_lopt_index_t lopt_index = { .sorted = lopt_sorted };
+
+#define xap_state_lopt(arguments) \
+	case LOPT: \
+		equal_sign = argv[i][lopt_len] == '=' ? argv[i] + lopt_len : NULL; \
+		found = xap_find_lopt(&lopt_index, lopt_names, NEXT_ARG, argv[i], lopt_len, XAP_ALLOW_ABBREVIATIONS); \
+		if (found < 0) { \
+			ctx.error = "ambiguous abbreviation"; \
+			xap_parser_return(); \
+		} \
+		if (found == UNKNOWN) { \
+			argv[i] = ctx.argument; \
+			i++; \
+			state = NEXT_ARG; \
+			break; \
+		} \
+		if (equal_sign != NULL) { \
+			argv[i] = equal_sign + 1; \
+		} \
+		else { \
+			xap_parser_mark(1); \
+		} \
+		state = found; \
+	break;
+
+/* positionals are looked up in a table indexed by position + 1; keywords all
+ * land on [0] and map to UNKNOWN, as do positions nothing is declared for */
+#define xap_derive_position_state(sopt, lopt, type, name, arry, conv) \
+	[xap_derive_is_keyword(sopt, lopt) ? 0 : (sopt) + 1] = \
+		xap_derive_is_keyword(sopt, lopt) ? UNKNOWN : xap_derive_state_name(sopt, lopt, type, name, arry, conv),
+#define xap_position_table(arguments) \
+	_Pragma("GCC diagnostic push") \
+	_Pragma("GCC diagnostic ignored \"-Woverride-init\"") \
+	static const unsigned short position_states[] = { UNKNOWN, arguments(xap_derive_position_state) }; \
+	_Pragma("GCC diagnostic pop")
+
+/* an undeclared position still counts, so later ones can be reached */
+#define xap_state_positional(arguments) \
+	case POSITIONAL: \
+		state = (size_t)position + 1 < sizeof(position_states) / sizeof(position_states[0]) \
+			? position_states[position + 1] : UNKNOWN; \
+		position++; \
+		if (state == UNKNOWN) { \
+			i++; \
+			state = NEXT_ARG; \
+		} \
+	break;
+
+#define xap_state_check(arguments, required) \
+	case CHECK: \
+		found = xap_first_missing_bit(required_mask, parsed, xap_bits_words(NEXT_ARG)); \
+		if (found != UNKNOWN) { \
+			ctx.error = "argument required"; \
+			ctx.argument = (char *)argument_names[found]; \
+			ctx.n_parameters = 0; \
+		} \
+		xap_parser_return(); \
+	break;
+
+/* parsed, required and stop_after arguments are bitsets indexed by state; the
+ * latter two are built from the ids in required() and stop_after() on first use,
+ * or on the stack while another thread is still building them */
+#define xap_derive_state_id(sopt, lopt, type, name, arry, conv) \
+	[xap_derive_state_name(sopt, lopt, type, name, arry, conv)] = xap_derive_id(sopt, lopt),
+#define xap_derive_argument_name(sopt, lopt, type, name, arry, conv) \
+	[xap_derive_state_name(sopt, lopt, type, name, arry, conv)] = lopt ? lopt : "at position " #sopt,
+#define xap_parser_masks(arguments, stop_after, required) \
+	static const int state_ids[NEXT_ARG] = { arguments(xap_derive_state_id) }; \
+	static const int required_ids[] = xap_ids(required), stop_after_ids[] = xap_ids(stop_after); \
+	static char const * const argument_names[NEXT_ARG] = { arguments(xap_derive_argument_name) }; \
+	static xap_bits_t required_bits[xap_bits_words(NEXT_ARG)], stop_after_bits[xap_bits_words(NEXT_ARG)]; \
+	static xap_once_t masks_ready; \
+	xap_bits_t parsed[xap_bits_words(NEXT_ARG)] = { 0 }; \
+	xap_bits_t * required_mask = required_bits, * stop_after_mask = stop_after_bits; \
+	xap_bits_t required_local[xap_bits_words(NEXT_ARG)], stop_after_local[xap_bits_words(NEXT_ARG)]; \
+	if (!xap_once_done(&masks_ready)) { \
+		bool won = xap_once_begin(&masks_ready); \
+		if (!won) { /* another thread is building them */ \
+			required_mask = memset(required_local, 0, sizeof(required_local)); \
+			stop_after_mask = memset(stop_after_local, 0, sizeof(stop_after_local)); \
+		} \
+		xap_set_bits_by_id(required_mask, state_ids, NEXT_ARG, required_ids, xap_count(required)); \
+		xap_set_bits_by_id(stop_after_mask, state_ids, NEXT_ARG, stop_after_ids, xap_count(stop_after)); \
+		if (won) xap_once_end(&masks_ready); \
+	}
+
+/* parser state machine */
+#define xap_parser_fsm(arguments, stop_after, required) \
+	enum state { \
+		UNKNOWN, \
+		arguments(xap_derive_state_name_comma) \
+		NEXT_ARG, \
+		POSITIONAL, \
+		SOPT, \
+		LOPT, \
+		CHECK \
+	} state = NEXT_ARG; \
+	xap_sopt_table(arguments) \
+	xap_lopt_table(arguments) \
+	xap_position_table(arguments) \
+	xap_parser_masks(arguments, stop_after, required) \
+	\
+	xap_instrument(xap_counter_add(stats->parses, 1); uint64_t conv_start;) \
+	for (;;) { \
+		xap_instrument(xap_stats_state(stats, state, i, *argc, argv);) \
+		switch (state) { \
+			xap_states_set_arg_X(arguments) \
+			xap_state_next_arg() \
+			xap_state_sopt(arguments) \
+			xap_state_lopt(arguments) \
+			xap_state_positional(arguments) \
+			xap_state_check(arguments, required) \
+			default: \
+				fprintf(stderr, "parser logic is wrong; submit a bug report\n"); \
+				exit(-1); \
+		} \
+	}
+
+
+/* the parser function */
+#define xap_declare_parser(name, struct_type) \
+	xap_error_context_t name(int * argc, char ** argv, struct_type * args)
+
+#define xap_derive_return_stop_after(sopt, lopt) \
+	if (id == xap_derive_id(sopt, lopt)) return true;
+
+#define xap_define_parser(name, struct_type, arguments, stop_after, required) \
+	bool xap_get_stop_after_ ## name(int id) \
+	{ \
+		(void)id; /* stop_after(_) may be empty */ \
+		stop_after(xap_derive_return_stop_after) \
+		return false; \
+	} \
+	xap_instrument( \
+		xap_stats_t * xap_get_stats_ ## name(void) \
+		{ \
+			enum state { UNKNOWN, arguments(xap_derive_state_name_comma) NEXT_ARG }; \
+			xap_stats_vars(#name, arguments) \
+			return &stats_data; \
+		} \
+	) \
+	xap_declare_parser(name, struct_type) \
+	{ \
+		xap_instrument(xap_stats_t * const stats = xap_get_stats_ ## name();) \
+		xap_parser_vars(arguments, stop_after, required); \
+		xap_parser_fsm(arguments, stop_after, required); \
+		return ctx; \
+	}
+
+/* run the converters of every xap_lazy_t field that was parsed but not yet
+ * converted, stopping at the first one that fails */
+#define xap_derive_validate(sopt, lopt, type, name, arry, conv) \
+	if (xap_is_lazy(args->name)) { \
+		xap_lazy_t * lazy = (xap_lazy_t *)(void *)&args->name; \
+		if (xap_lazy_failed(lazy)) { \
+			ctx.error = lazy->error; \
+			ctx.argument = lopt ? lopt : "at position " #sopt; \
+			ctx.n_parameters = lazy->argc; \
+			ctx.parameters = lazy->argv; \
+			return ctx; \
+		} \
+	}
+
+#define xap_declare_validate_all(name, struct_type) \
+	xap_error_context_t name(struct_type * args)
+
+#define xap_define_validate_all(name, struct_type, arguments) \
+	xap_declare_validate_all(name, struct_type) \
+	{ \
+		xap_error_context_t ctx = { 0 }; \
+		arguments(xap_derive_validate) \
+		return ctx; \
+	}
+
+/* serializer
+ *
+ * writes the positionals in order (with "" for any gaps), then the keywords
+ * that are set with the flags after them, then rest fields, and finally the
+ * stop_after keywords, since parsing stops at them, so that parsing the
+ * result into a zeroed struct_type gives back the same values; every conv
+ * needs a conv_format counterpart
+ */
+static inline
+bool xap_id_in(int id, int const * ids, size_t n)
+{
+	for (size_t k = 0; k < n; k++) if (ids[k] == id) return true;
+	return false;
+}
+
+#define xap_derive_is_stop_after(sopt, lopt) \
+	xap_id_in(xap_derive_id(sopt, lopt), stop_after_ids, n_stop_after)
+#define xap_derive_max_position(sopt, lopt, type, name, arry, conv) \
+	if (!xap_derive_is_keyword(sopt, lopt) && -xap_derive_id(sopt, lopt) > max_position) \
+		max_position = -xap_derive_id(sopt, lopt);
+
+#define xap_derive_serialize_position(sopt, lopt, type, name, arry, conv) \
+	if (!xap_derive_is_keyword(sopt, lopt) && -xap_derive_id(sopt, lopt) == position) { \
+		w.option = NULL; \
+		if (xap_is_rest(args->name)) rest_position = position; \
+		else found = conv ## _format(&w, &args->name); \
+	}
+
+#define xap_derive_plus_one(...) + 1
+
+#define xap_derive_serialize_keyword(sopt, lopt, type, name, arry, conv) \
+	if (xap_derive_is_keyword(sopt, lopt) && !xap_is_rest(args->name) && !xap_derive_is_stop_after(sopt, lopt)) { \
+		xap_writer_t unset = w; \
+		xap_write_option(&w, sopt, (char const *)(lopt)); \
+		size_t named = w.argc; \
+		bool given = conv ## _format(&w, &args->name); \
+		is_flag[k] = given && w.argc == named; \
+		if (!given || is_flag[k]) w = unset; \
+	} \
+	k++;
+
+#define xap_derive_serialize_flag(sopt, lopt, type, name, arry, conv) \
+	if (is_flag[k++]) xap_write_option(&w, sopt, (char const *)(lopt));
+
+/* rest fields go last since they take everything after them; a positional
+ * one needs the placeholders that lead up to it */
+#define xap_derive_serialize_rest(sopt, lopt, type, name, arry, conv) \
+	if (xap_is_rest(args->name)) { \
+		xap_writer_t unset = w; \
+		if (xap_derive_is_keyword(sopt, lopt)) xap_write_option(&w, sopt, (char const *)(lopt)); \
+		else for (int gap = 0; gap < gaps; gap++) xap_write_arg(&w, ""); \
+		if (!conv ## _format(&w, &args->name)) w = unset; \
+	}
+
+/* parsing stops after the first of these, so only one of them can be set */
+#define xap_derive_serialize_stop_after(sopt, lopt, type, name, arry, conv) \
+	if (xap_derive_is_keyword(sopt, lopt) && !xap_is_rest(args->name) && xap_derive_is_stop_after(sopt, lopt)) { \
+		xap_writer_t unset = w; \
+		xap_write_option(&w, sopt, (char const *)(lopt)); \
+		if (!conv ## _format(&w, &args->name)) w = unset; \
+	}
+
+#define xap_declare_serializer(name, struct_type) \
+	char ** name(struct_type const * args, void * buffer, size_t size, int * argc)
+
+/* returns an argv inside buffer, or NULL if it does not fit */
+#define xap_define_serializer(name, struct_type, arguments, stop_after) \
+	xap_declare_serializer(name, struct_type) \
+	{ \
+		static const int stop_after_ids[] = xap_ids(stop_after); \
+		size_t const n_stop_after = xap_count(stop_after); \
+		xap_writer_t w = xap_writer(buffer, size); \
+		int max_position = -1, rest_position = -1; \
+		arguments(xap_derive_max_position) \
+		xap_writer_t given = w; \
+		for (int position = 0; position <= max_position; position++) { \
+			bool found = false; \
+			arguments(xap_derive_serialize_position) \
+			if (position == rest_position) break; \
+			if (found) given = w; \
+			else xap_write_arg(&w, ""); \
+		} \
+		int gaps = w.argc - given.argc; \
+		w = given; /* no trailing placeholders */ \
+		bool is_flag[0 arguments(xap_derive_plus_one)] = { false }; \
+		size_t k = 0; \
+		arguments(xap_derive_serialize_keyword) \
+		k = 0; \
+		arguments(xap_derive_serialize_flag) \
+		arguments(xap_derive_serialize_rest) \
+		arguments(xap_derive_serialize_stop_after) \
+		return xap_writer_argv(&w, argc); \
+	}
+
+/* batch parsing
+ *
+ * generated parsers keep no mutable state besides lookup structures that are
+ * built once through xap_once_t, so with C11 atomics, any number of threads
+ * may run them (and the xap_get_stop_after_ helpers) at the same time
+ */
+typedef struct xap_batch_item {
+	int argc;       /* updated like the argc passed to a parser */
+	char ** argv;
+	void * args;
+} xap_batch_item_t;
+
+typedef xap_error_context_t (*xap_parser_t)(int * argc, char ** argv, void * args);
+
+#ifndef XAP_BATCH_CHUNK
+#define XAP_BATCH_CHUNK 256  /* most items a thread claims at once */
+#endif
+
+typedef struct xap_batch {
+	xap_parser_t parse;
+	xap_batch_item_t * items;
+	xap_error_context_t * results;
+	size_t n_items;
+	size_t chunk;
+#ifdef XAP_HAVE_THREADS
+	atomic_size_t next;
+	atomic_size_t n_failed;
+#else
+	size_t next;
+	size_t n_failed;
+#endif
+} xap_batch_t;
+
+/* claims chunks of items until none are left */
+static inline
+void * xap_batch_worker(void * data)
+{
+	xap_batch_t * batch = data;
+	size_t n_failed = 0;
+	for (;;) {
+#ifdef XAP_HAVE_THREADS
+		size_t begin = atomic_fetch_add_explicit(&batch->next, batch->chunk, memory_order_relaxed);
+#else
+		size_t begin = batch->next;
+		batch->next += batch->chunk;
+#endif
+		if (begin >= batch->n_items) break;
+		size_t end = batch->n_items - begin < batch->chunk ? batch->n_items : begin + batch->chunk;
+		for (size_t k = begin; k < end; k++) {
+			xap_batch_item_t * item = batch->items + k;
+			batch->results[k] = batch->parse(&item->argc, item->argv, item->args);
+			n_failed += batch->results[k].error != NULL;
+		}
+	}
+#ifdef XAP_HAVE_THREADS
+	atomic_fetch_add_explicit(&batch->n_failed, n_failed, memory_order_relaxed);
+#else
+	batch->n_failed += n_failed;
+#endif
+	return NULL;
+}
+
+/* parse n_items independent command lines on up to n_threads threads (one per
+ * online CPU if n_threads <= 0), the calling thread included, and store one
+ * result per item; returns the number of items that failed to parse */
+static inline
+size_t xap_parse_batch(xap_parser_t parse, size_t n_items, xap_batch_item_t * items, xap_error_context_t * results, int n_threads)
+{
+	xap_batch_t batch = { .parse = parse, .items = items, .results = results, .n_items = n_items };
+#ifdef XAP_HAVE_THREADS
+	if (n_threads <= 0) {
+		long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		n_threads = n_cpus > 0 ? (int)n_cpus : 1;
+	}
+	if ((size_t)n_threads > n_items) n_threads = n_items > 0 ? (int)n_items : 1;
+#else
+	n_threads = 1;
+#endif
+	/* small enough to even out the threads' load, large enough to keep them
+	 * off each other's cache lines */
+	batch.chunk = n_items / ((size_t)n_threads * 8);
+	if (batch.chunk > XAP_BATCH_CHUNK) batch.chunk = XAP_BATCH_CHUNK;
+	if (batch.chunk == 0) batch.chunk = 1;
+
+#ifdef XAP_HAVE_THREADS
+	pthread_t threads[n_threads];
+	int n_started = 0;
+	while (n_started < n_threads - 1 && pthread_create(threads + n_started, NULL, xap_batch_worker, &batch) == 0)
+		n_started++;
+	xap_batch_worker(&batch);
+	for (int t = 0; t < n_started; t++) pthread_join(threads[t], NULL);
+	return atomic_load(&batch.n_failed);
+#else
+	xap_batch_worker(&batch);
+	return batch.n_failed;
+#endif
+}
+
+#define xap_declare_batch_parser(name) \
+	size_t name(size_t n_items, xap_batch_item_t * items, xap_error_context_t * results, int n_threads)
+
+/* items[k].args must point to the parser's struct_type */
+#define xap_define_batch_parser(name, struct_type, parser) \
+	static xap_error_context_t xap_batch_ ## name(int * argc, char ** argv, void * args) \
+	{ \
+		return parser(argc, argv, (struct_type *)args); \
+	} \
+	xap_declare_batch_parser(name) \
+	{ \
+		return xap_parse_batch(xap_batch_ ## name, n_items, items, results, n_threads); \
+	}
+
+/* compact structs
+ *
+ * the fields of xap_struct(arguments), but with the toggles packed into bits
+ * at the front and the rest after them by increasing alignment, so that only
+ * the tail can be padding. The preprocessor cannot sort, so every field is a
+ * member of an anonymous union with as many bytes in front of it as the
+ * fields before it take up. Those are counted by helper structs: one byte per
+ * field in _index, and one byte per field plus the size of each field with
+ * that alignment in _align<n>. The helpers are named after the line, so there
+ * can be one compact struct per line.
+ */
+#define xap_cat_(a, b) a ## b
+#define xap_cat(a, b) xap_cat_(a, b)
+#define xap_second_(a, b, ...) b
+#define xap_second(...) xap_second_(__VA_ARGS__)
+
+#define xap_probe_xap_toggle ~, 1
+#define xap_is_toggle(conv) xap_second(xap_probe_ ## conv, 0, ~)
+#define xap_if_0(yes, no) no
+#define xap_if_1(yes, no) yes
+#define xap_if_toggle(conv, yes, no) xap_cat(xap_if_, xap_is_toggle(conv))(yes, no)
+
+#define xap_compact_type(kind) \
+	struct xap_cat(xap_compact_ ## kind ## _, __LINE__)
+
+#define xap_compact_bytes(n, type, name, arry, conv) \
+	unsigned char name[1 + (_Alignof(type arry) == n ? xap_if_toggle(conv, 0, sizeof(type arry)) : 0)];
+#define xap_compact_class(n) \
+	(sizeof(xap_compact_type(align ## n)) - sizeof(xap_compact_type(index)))
+#define xap_compact_within(n, name) \
+	(offsetof(xap_compact_type(align ## n), name) - offsetof(xap_compact_type(index), name))
+
+/* the flags, then every class with less alignment, rounded up to a */
+#define xap_compact_start(a) \
+	((sizeof(xap_compact_type(flags)) \
+		+ (a > 1 ? xap_compact_class(1) : 0) + (a > 2 ? xap_compact_class(2) : 0) \
+		+ (a > 4 ? xap_compact_class(4) : 0) + (a > 8 ? xap_compact_class(8) : 0) \
+		+ a - 1) / a * a)
+#define xap_compact_offset(type, name, arry) \
+	(xap_compact_start(_Alignof(type arry)) + ( \
+		_Alignof(type arry) == 1 ? xap_compact_within(1, name) : \
+		_Alignof(type arry) == 2 ? xap_compact_within(2, name) : \
+		_Alignof(type arry) == 4 ? xap_compact_within(4, name) : \
+		_Alignof(type arry) == 8 ? xap_compact_within(8, name) : xap_compact_within(16, name)))
+
+/* fields aligned to more than 16 bytes would not fit the classes */
+#define xap_derive_compact_index(sopt, lopt, type, name, arry, conv) \
+	unsigned char name[_Alignof(type arry) <= 16 ? 1 : -1];
+#define xap_derive_compact_align1(sopt, lopt, type, name, arry, conv) \
+	xap_compact_bytes(1, type, name, arry, conv)
+#define xap_derive_compact_align2(sopt, lopt, type, name, arry, conv) \
+	xap_compact_bytes(2, type, name, arry, conv)
+#define xap_derive_compact_align4(sopt, lopt, type, name, arry, conv) \
+	xap_compact_bytes(4, type, name, arry, conv)
+#define xap_derive_compact_align8(sopt, lopt, type, name, arry, conv) \
+	xap_compact_bytes(8, type, name, arry, conv)
+#define xap_derive_compact_align16(sopt, lopt, type, name, arry, conv) \
+	xap_compact_bytes(16, type, name, arry, conv)
+
+/* xap_flags_end keeps the flags at least a byte long, so no field has an
+ * empty array in front of it */
+#define xap_derive_compact_flag(sopt, lopt, type, name, arry, conv) \
+	xap_if_toggle(conv, type name : 1;, )
+#define xap_compact_flags(arguments) \
+	arguments(xap_derive_compact_flag) bool xap_flags_end : 1;
+
+#define xap_derive_compact_field(sopt, lopt, type, name, arry, conv) \
+	xap_if_toggle(conv, , struct { unsigned char xap_pad_ ## name[xap_compact_offset(type, name, arry)]; type name arry; };)
+
+#define xap_define_compact_struct(tag, arguments) \
+	xap_compact_type(index) { arguments(xap_derive_compact_index) }; \
+	xap_compact_type(align1) { arguments(xap_derive_compact_align1) }; \
+	xap_compact_type(align2) { arguments(xap_derive_compact_align2) }; \
+	xap_compact_type(align4) { arguments(xap_derive_compact_align4) }; \
+	xap_compact_type(align8) { arguments(xap_derive_compact_align8) }; \
+	xap_compact_type(align16) { arguments(xap_derive_compact_align16) }; \
+	xap_compact_type(flags) { xap_compact_flags(arguments) }; \
+	struct tag { union { struct { xap_compact_flags(arguments) }; arguments(xap_derive_compact_field) }; }
+
+#define xap_derive_compact_pack(sopt, lopt, type, name, arry, conv) \
+	xap_if_toggle(conv, compact->name = args->name;, memcpy(&compact->name, &args->name, sizeof(args->name));)
+#define xap_derive_compact_unpack(sopt, lopt, type, name, arry, conv) \
+	xap_if_toggle(conv, args->name = compact->name;, memcpy(&args->name, &compact->name, sizeof(args->name));)
+
+#define xap_declare_compact(name, compact_type, struct_type) \
+	void name ## _pack(compact_type * compact, struct_type const * args); \
+	void name ## _unpack(struct_type * args, compact_type const * compact)
+
+/* name_pack(compact, args) and name_unpack(args, compact) copy every field
+ * between the two layouts */
+#define xap_define_compact(name, compact_type, struct_type, arguments) \
+	void name ## _pack(compact_type * compact, struct_type const * args) \
+	{ \
+		arguments(xap_derive_compact_pack) \
+	} \
+	\
+	void name ## _unpack(struct_type * args, compact_type const * compact) \
+	{ \
+		arguments(xap_derive_compact_unpack) \
+	}
+
+#define xap_declare_compact_parser(name, compact_type) \
+	xap_error_context_t name(int * argc, char ** argv, compact_type * compact)
+
+/* toggles have no address for a converter to write to, so parser fills a
+ * struct_type that starts out as compact and is packed back into it */
+#define xap_define_compact_parser(name, compact_type, struct_type, arguments, parser) \
+	xap_declare_compact_parser(name, compact_type) \
+	{ \
+		struct_type unpacked, * args = &unpacked; \
+		arguments(xap_derive_compact_unpack) \
+		xap_error_context_t ctx = parser(argc, argv, args); \
+		arguments(xap_derive_compact_pack) \
+		return ctx; \
+	}
+
+/* size report */
+#define xap_derive_compact_width(sopt, lopt, type, name, arry, conv) \
+	if (width < (int)sizeof(#name) - 1) width = (int)sizeof(#name) - 1;
+
+#define xap_derive_compact_fprint_size(sopt, lopt, type, name, arry, conv) \
+	cnt += fprintf(stream, "%-*s %6zu %6zu", width, #name, \
+		sizeof(((xap_compact_struct *)NULL)->name), offsetof(xap_compact_struct, name)); \
+	xap_if_toggle(conv, \
+		cnt += fprintf(stream, "  bit %d\n", n_bits++);, \
+		cnt += fprintf(stream, " %6zu\n", offsetof(xap_compact_packed, name)); \
+		used += sizeof(((xap_compact_struct *)NULL)->name);) \
+	fields += sizeof(((xap_compact_struct *)NULL)->name);
+
+#define xap_declare_compact_fprint_sizes(name) \
+	int name(FILE * stream)
+
+/* one line per field with its size, its offset in struct_type and its
+ * offset (or bit) in compact_type, then the totals and padding of both */
+#define xap_define_compact_fprint_sizes(name, compact_type, struct_type, arguments) \
+	xap_declare_compact_fprint_sizes(name) \
+	{ \
+		typedef struct_type xap_compact_struct; \
+		typedef compact_type xap_compact_packed; \
+		int cnt = 0, width = (int)sizeof("field") - 1, n_bits = 0; \
+		size_t fields = 0, used = 0; \
+		arguments(xap_derive_compact_width) \
+		cnt += fprintf(stream, "%-*s %6s %6s %6s\n", width, "field", "size", "offset", "packed"); \
+		arguments(xap_derive_compact_fprint_size) \
+		size_t flag_bytes = sizeof(struct { xap_compact_flags(arguments) }); \
+		cnt += fprintf(stream, "%s: %zu bytes, %zu of them padding\n", #struct_type, \
+			sizeof(struct_type), sizeof(struct_type) - fields); \
+		cnt += fprintf(stream, "%s: %zu bytes, %zu of them padding, %d toggles in %zu bits\n", #compact_type, \
+			sizeof(compact_type), sizeof(compact_type) - used - flag_bytes, n_bits, 8 * flag_bytes); \
+		return cnt; \
+	}
+
+#ifdef XAP_POSIX
+/* snapshot cache
+ *
+ * a successful parse is saved as the bytes of the struct plus, for each
+ * string field and leftover argument, the argument it points into; when argv
+ * and the layout of arguments(_) are the same next time, that is copied back
+ * instead of parsing. Only structs of numbers, strings and arrays of those are
+ * cached, and only when every string points into argv or at whatever the
+ * field held before parsing. The struct as the caller set it up is part of
+ * the key, except for the strings, whose old values are kept anyway.
+ */
+#define XAP_SNAPSHOT_VERSION 1
+#define XAP_HASH_SEED UINT64_C(0xcbf29ce484222325)
+
+/* FNV-1a, but on 8 bytes at a time; the snapshot is compared in full anyway */
+static inline
+uint64_t xap_hash_bytes(uint64_t hash, void const * data, size_t size)
+{
+	unsigned char const * bytes = data;
+	uint64_t word;
+	for (; size >= sizeof(word); bytes += sizeof(word), size -= sizeof(word)) {
+		memcpy(&word, bytes, sizeof(word));
+		hash = (hash ^ word ^ (word >> 29)) * UINT64_C(0x100000001b3);
+	}
+	for (; size; bytes++, size--) hash = (hash ^ *bytes) * UINT64_C(0x100000001b3);
+	return hash;
+}
+
+typedef struct xap_snapshot_header {
+	char magic[4];          /* "XAPS" */
+	uint32_t version;
+	uint64_t layout;
+	uint64_t argv_hash;     /* and of the struct before parsing */
+	uint64_t checksum;      /* of everything after the header */
+	uint32_t argc;
+	uint32_t argv_size;     /* the strings of argv follow the header */
+	uint32_t struct_size;   /* then the struct, then the references */
+	uint32_t n_leftovers;   /* the first references are the leftovers */
+	uint32_t n_refs;
+	uint32_t reserved;
+} xap_snapshot_header_t;
+
+/* a pointer to argv[index] + offset, or to the field's old value if index < 0 */
+typedef struct xap_snapshot_ref {
+	uint32_t field;
+	int32_t index;
+	uint32_t offset;
+} xap_snapshot_ref_t;
+
+#define xap_snapshot_align(n) (((n) + 7) / 8 * 8)
+
+static inline
+bool xap_snapshot_load(char const * path, uint64_t layout, uint64_t argv_hash, size_t argv_size, int * argc, char ** argv, void * args, size_t size)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(xap_snapshot_header_t)) {
+		close(fd);
+		return false;
+	}
+	char * data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) return false;
+
+	xap_snapshot_header_t header;
+	memcpy(&header, data, sizeof(header));
+	size_t object = xap_snapshot_align(sizeof(header) + argv_size);
+	size_t refs = xap_snapshot_align(object + size);
+	/* the sizes are checked before anything past the header is read */
+	bool ok = memcmp(header.magic, "XAPS", 4) == 0 && header.version == XAP_SNAPSHOT_VERSION
+		&& header.layout == layout && header.argv_hash == argv_hash
+		&& header.argc == (uint32_t)*argc && header.argv_size == argv_size && header.struct_size == size
+		&& header.n_leftovers <= header.argc && header.n_leftovers <= header.n_refs
+		&& (uint64_t)st.st_size >= refs
+		&& header.n_refs <= ((uint64_t)st.st_size - refs) / sizeof(xap_snapshot_ref_t)
+		&& header.checksum == xap_hash_bytes(XAP_HASH_SEED, data + sizeof(header), refs - sizeof(header) + header.n_refs * sizeof(xap_snapshot_ref_t));
+
+	/* the same arguments, and references that stay inside them */
+	char const * string = data + sizeof(header);
+	for (int k = 0; ok && k < *argc; k++) {
+		size_t len = strlen(argv[k]) + 1;
+		ok = memcmp(string, argv[k], len) == 0;
+		string += len;
+	}
+	for (size_t k = 0; ok && k < header.n_refs; k++) {
+		xap_snapshot_ref_t ref;
+		memcpy(&ref, data + refs + k * sizeof(ref), sizeof(ref));
+		ok = ref.index < 0 ? k >= header.n_leftovers : ref.index < *argc && ref.offset <= strlen(argv[ref.index]);
+		ok = ok && (k < header.n_leftovers || ref.field <= size - sizeof(char *));
+	}
+
+	if (ok) {
+		size_t n_strings = header.n_refs - header.n_leftovers;
+		char * kept[n_strings + 1];
+		xap_snapshot_ref_t ref;
+		for (size_t k = 0; k < n_strings; k++) {
+			memcpy(&ref, data + refs + (header.n_leftovers + k) * sizeof(ref), sizeof(ref));
+			memcpy(kept + k, (char *)args + ref.field, sizeof(char *));
+		}
+		memcpy(args, data + object, size);
+		for (size_t k = 0; k < n_strings; k++) {
+			memcpy(&ref, data + refs + (header.n_leftovers + k) * sizeof(ref), sizeof(ref));
+			char * value = ref.index < 0 ? kept[k] : argv[ref.index] + ref.offset;
+			memcpy((char *)args + ref.field, &value, sizeof(char *));
+		}
+		/* in place, since the leftovers only ever move down */
+		for (size_t k = 0; k < header.n_leftovers; k++) {
+			memcpy(&ref, data + refs + k * sizeof(ref), sizeof(ref));
+			argv[k] = argv[ref.index] + ref.offset;
+		}
+		*argc = header.n_leftovers;
+	}
+	munmap(data, st.st_size);
+	return ok;
+}
+
+/* the argument p points into, at or after argv[first] */
+static inline
+int xap_snapshot_index(int argc, char ** argv, int first, char const * p)
+{
+	for (int k = first; k < argc; k++)
+		if (p >= argv[k] && p <= argv[k] + strlen(argv[k])) return k;
+	return -1;
+}
+
+/* replaces the file at path atomically; failures just mean there is no snapshot.
+ * O_EXCL keeps the temporary file from following a link someone else put there */
+static inline
+void xap_snapshot_write(char const * path, char const * data, size_t size)
+{
+	char tmp[strlen(path) + 24];
+	snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long)getpid());
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (fd < 0) return;
+	size_t written = 0;
+	while (written < size) {
+		ssize_t n = write(fd, data + written, size - written);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) break;
+		written += n;
+	}
+	if (close(fd) != 0 || written < size || rename(tmp, path) != 0) unlink(tmp);
+}
+
+static inline
+void xap_snapshot_save(char const * path, uint64_t layout, uint64_t argv_hash, size_t argv_size,
+	int n_original, char ** original, int argc, char ** argv,
+	void const * args, void const * before, size_t size, size_t const * string_fields, size_t n_fields)
+{
+	size_t n_strings = 0;
+	for (size_t k = 0; k < n_fields; k++) n_strings += string_fields[2 * k + 1];
+	size_t object = xap_snapshot_align(sizeof(xap_snapshot_header_t) + argv_size);
+	size_t refs = xap_snapshot_align(object + size);
+	size_t total = refs + (argc + n_strings) * sizeof(xap_snapshot_ref_t);
+	char * data = calloc(1, total);
+	if (data == NULL) return;
+
+	xap_snapshot_ref_t * ref = (xap_snapshot_ref_t *)(data + refs);
+	for (int k = 0, index = 0; k < argc; k++, index++) {
+		index = xap_snapshot_index(n_original, original, index, argv[k]);
+		if (index < 0) goto out;
+		*ref++ = (xap_snapshot_ref_t){ 0, index, argv[k] - original[index] };
+	}
+	for (size_t k = 0; k < n_fields; k++) for (size_t j = 0; j < string_fields[2 * k + 1]; j++) {
+		size_t field = string_fields[2 * k] + j * sizeof(char *);
+		char * value, * old;
+		memcpy(&value, (char const *)args + field, sizeof(char *));
+		memcpy(&old, (char const *)before + field, sizeof(char *));
+		int index = value == old ? -1 : xap_snapshot_index(n_original, original, 0, value);
+		if (index < 0 && value != old) goto out;
+		*ref++ = (xap_snapshot_ref_t){ field, index, index < 0 ? 0 : value - original[index] };
+	}
+
+	xap_snapshot_header_t header = {
+		.magic = "XAPS", .version = XAP_SNAPSHOT_VERSION, .layout = layout, .argv_hash = argv_hash,
+		.argc = n_original, .argv_size = argv_size, .struct_size = size,
+		.n_leftovers = argc, .n_refs = ref - (xap_snapshot_ref_t *)(data + refs),
+	};
+	char * string = data + sizeof(header);
+	for (int k = 0; k < n_original; k++) {
+		size_t len = strlen(original[k]) + 1;
+		memcpy(string, original[k], len);
+		string += len;
+	}
+	memcpy(data + object, args, size);
+	header.checksum = xap_hash_bytes(XAP_HASH_SEED, data + sizeof(header), (char *)ref - data - sizeof(header));
+	memcpy(data, &header, sizeof(header));
+	xap_snapshot_write(path, data, (char *)ref - data);
+out:
+	free(data);
+}
+
+static inline
+xap_error_context_t xap_snapshot_parse(char const * path, uint64_t layout, xap_parser_t parse,
+	int * argc, char ** argv, void * args, size_t size, size_t const * string_fields, size_t n_fields, bool cacheable)
+{
+	uint64_t argv_hash = xap_hash_bytes(XAP_HASH_SEED, argc, sizeof(*argc));
+	size_t argv_size = 0;
+	for (int k = 0; k < *argc; k++) {
+		size_t len = strlen(argv[k]) + 1;
+		argv_hash = xap_hash_bytes(argv_hash, argv[k], len);
+		argv_size += len;
+	}
+	cacheable = cacheable && argv_size <= UINT32_MAX && size <= UINT32_MAX;
+	void * before = cacheable ? malloc(size) : NULL;
+	if (before != NULL) {
+		/* defaults, but not the addresses of default strings */
+		memcpy(before, args, size);
+		for (size_t k = 0; k < n_fields; k++)
+			memset((char *)before + string_fields[2 * k], 0, string_fields[2 * k + 1] * sizeof(char *));
+		argv_hash = xap_hash_bytes(argv_hash, before, size);
+		memcpy(before, args, size);
+		if (xap_snapshot_load(path, layout, argv_hash, argv_size, argc, argv, args, size)) {
+			free(before);
+			return (xap_error_context_t){ 0 };
+		}
+	}
+
+	int n_original = *argc;
+	char ** original = before ? malloc((n_original + 1) * sizeof(char *)) : NULL;
+	if (original != NULL) memcpy(original, argv, n_original * sizeof(char *));
+	xap_error_context_t ctx = parse(argc, argv, args);
+	if (ctx.error == NULL && original != NULL)
+		xap_snapshot_save(path, layout, argv_hash, argv_size, n_original, original, *argc, argv, args, before, size, string_fields, n_fields);
+	free(before);
+	free(original);
+	return ctx;
+}
+
+#define xap_derive_layout_text(sopt, lopt, type, name, arry, conv) \
+	#sopt "," #lopt "," #type "," #name #arry "," #conv ";"
+
+#define xap_derive_field_layout(sopt, lopt, type, name, arry, conv) \
+	offsetof(xap_snapshot_struct, name), sizeof(((xap_snapshot_struct *)NULL)->name),
+
+/* fields are told apart by the type of their address, since arrays decay
+ * to pointers to their elements but &array does not */
+#define xap_snapshot_numbers(ptr) \
+	bool ptr: 1, char ptr: 1, signed char ptr: 1, unsigned char ptr: 1, \
+	short ptr: 1, unsigned short ptr: 1, int ptr: 1, unsigned ptr: 1, \
+	long ptr: 1, unsigned long ptr: 1, long long ptr: 1, unsigned long long ptr: 1, \
+	float ptr: 1, double ptr: 1, long double ptr: 1
+#define xap_snapshot_strings(ptr) \
+	char * ptr: 1, char const * ptr: 1
+
+#define xap_snapshot_is_array(field, types) \
+	(_Generic((field), types(*), default: 0) && !_Generic(&(field), types(**), default: 0))
+#define xap_snapshot_is_plain(field) \
+	(_Generic(&(field), xap_snapshot_numbers(*), default: 0) || xap_snapshot_is_array(field, xap_snapshot_numbers))
+#define xap_snapshot_n_strings(field) \
+	(_Generic(&(field), xap_snapshot_strings(*), default: 0) ? 1 \
+	: xap_snapshot_is_array(field, xap_snapshot_strings) ? sizeof(field) / (sizeof(char *)) : 0)
+
+/* the offset of each field and how many strings start there */
+#define xap_derive_string_field(sopt, lopt, type, name, arry, conv) \
+	offsetof(xap_snapshot_struct, name), xap_snapshot_n_strings(((xap_snapshot_struct *)NULL)->name),
+
+/* anything else may point outside of argv: lists, lazy and rest fields, or
+ * pointers a custom converter set */
+#define xap_derive_has_pointers(sopt, lopt, type, name, arry, conv) \
+	|| !(xap_snapshot_is_plain(((xap_snapshot_struct *)NULL)->name) \
+		|| xap_snapshot_n_strings(((xap_snapshot_struct *)NULL)->name))
+
+#define xap_declare_snapshot_parser(name, struct_type) \
+	xap_error_context_t name(char const * path, int * argc, char ** argv, struct_type * args)
+
+/* parser as defined for arguments, with its results cached in the file at path */
+#define xap_define_snapshot_parser(name, struct_type, arguments, parser) \
+	static xap_error_context_t xap_snapshot_ ## name(int * argc, char ** argv, void * args) \
+	{ \
+		return parser(argc, argv, (struct_type *)args); \
+	} \
+	xap_declare_snapshot_parser(name, struct_type) \
+	{ \
+		typedef struct_type xap_snapshot_struct; \
+		static char const layout_text[] = #parser ":" arguments(xap_derive_layout_text); \
+		static size_t const fields[] = { sizeof(struct_type), arguments(xap_derive_field_layout) }; \
+		static size_t const string_fields[] = { arguments(xap_derive_string_field) }; \
+		bool cacheable = !(false arguments(xap_derive_has_pointers)); \
+		uint64_t layout = xap_hash_bytes(XAP_HASH_SEED, layout_text, sizeof(layout_text)); \
+		layout = xap_hash_bytes(layout, fields, sizeof(fields)); \
+		return xap_snapshot_parse(path, layout, xap_snapshot_ ## name, argc, argv, args, sizeof(struct_type), \
+			string_fields, sizeof(string_fields) / sizeof(string_fields[0]) / 2, cacheable); \
+	}
+#endif
+
+/* usage function */
+#define xap_derive_update_is_required(sopt, lopt) \
+	if (id == xap_derive_id(sopt, lopt)) is_required = true;
+
+#define xap_derive_update_display_name(sopt, lopt, disp, desc) \
+	if (id == xap_derive_id(sopt, lopt) && disp != NULL) display_name = disp;
+
+#define xap_derive_argument_usage_print_lopt(sopt, lopt, type, name, arry, conv) \
+	cnt += lopt \
+		? fprintf(stream, is_required ? " --%s%s%s" : " [--%s%s%s]", (char *)lopt, space, display_name) \
+		: fprintf(stream, is_required ? " %s"       : " [%s]"                           , display_name);
+#define xap_derive_argument_usage_print_sopt(sopt, lopt, type, name, arry, conv) \
+	cnt += lopt && !xap_derive_has_sopt(sopt, lopt) \
+		? fprintf(stream, is_required ? " --%s%s%s" : " [--%s%s%s]", (char *)lopt, space, display_name) \
+		: lopt \
+		? fprintf(stream, is_required ? " -%c%s%s" : " [-%c%s%s]", sopt, space, display_name) \
+		: fprintf(stream, is_required ? " %s"       : " [%s]"                 , display_name);
+
+#define xap_derive_argument_usage_print xap_derive_argument_usage_print_lopt
+
+#define xap_derive_argument_usage(sopt, lopt, type, name, arry, conv) \
+	id = xap_derive_id(sopt, lopt); \
+	is_required = false; \
+	for (int i = 0; !is_required && i < n_required_ids; i++) \
+		is_required = required_ids[i] == id; \
+	display_name = get_name(id); \
+	if (display_name == NULL) display_name = #name #arry; \
+	space = display_name[0] == '\0' ? "" : " "; \
+	xap_derive_argument_usage_print(sopt, lopt, type, name, arry, conv)
+
+#define xap_declare_fprint_usage(name) \
+	int name(FILE * stream)
+
+#define xap_derive_return_name(sopt, lopt, disp, desc) \
+	if (id == xap_derive_id(sopt, lopt)) return disp;
+
+#define xap_define_fprint_usage(name, arguments, required, display_hints) \
+	char * xap_get_name_ ## name(int id) \
+	{ \
+		display_hints(xap_derive_return_name) \
+		return NULL; \
+	} \
+	\
+	xap_declare_fprint_usage(name) \
+	{ \
+		char * (*get_name)(int) = xap_get_name_ ## name; \
+		const int n_required_ids = xap_count(required); \
+		const int required_ids[xap_count(required)] = xap_ids(required); \
+		bool is_required; \
+		int cnt = 0, id; \
+		char * display_name, * space; \
+		cnt += fprintf(stream, "usage:"); \
+		arguments(xap_derive_argument_usage); \
+		cnt += fputc('\n', stream) != EOF; \
+		return cnt; \
+	}
+
+/* help function */
+#define xap_derive_fprint_positional_help(sopt, lopt, type, name, arry, conv) \
+	if (!lopt) { \
+		int id = xap_derive_id(sopt, lopt); \
+		char * desc = get_desc(id); \
+		if (desc != NULL && desc[0] != '\0') { \
+			char * disp = get_disp(id); \
+			cnt += fprintf(stream, "  %-20s %s\n", disp != NULL ? disp : "", desc); \
+		} \
+	};
+
+#define xap_derive_fprint_keyword_help(sopt, lopt, type, name, arry, conv) \
+	if (lopt) { \
+		int id = xap_derive_id(sopt, lopt); \
+		char * desc = get_desc(id); \
+		if (desc != NULL && desc[0] != '\0') { \
+			char * disp = get_disp(id); \
+			int n = 0; \
+			if (xap_derive_has_sopt(sopt, lopt)) \
+				n += fprintf(stream, "  -%c", sopt); \
+			else \
+				n += fprintf(stream, "    "); \
+			if (((char *)lopt)[0] != '\0') \
+				n += fprintf(stream, xap_derive_has_sopt(sopt, lopt) ? ", --%s  " : "  --%s  ", (char *)lopt); \
+			else \
+				n += fputs("  ", stream); \
+			if (disp) \
+				n += fprintf(stream, "%s", disp); \
+			cnt += n; \
+			cnt += n >= 23 ? fprintf(stream, "\n%*.*s", 23, 23, "") : fprintf(stream, "%*.*s", 23 - n, 23 - n, ""); \
+			cnt += fprintf(stream, "%s\n", desc); \
+		} \
+	};
+
+
+#define xap_derive_return_desc(sopt, lopt, disp, desc) \
+	if (id == xap_derive_id(sopt, lopt)) return desc;
+#define xap_derive_return_disp(sopt, lopt, disp, desc) \
+	if (id == xap_derive_id(sopt, lopt)) return disp;
+
+#define xap_define_fprint_help(name, arguments, display_hints) \
+	char * xap_get_desc_ ## name(int id) \
+	{ \
+		display_hints(xap_derive_return_desc) \
+		return "---"; \
+	} \
+	\
+	char * xap_get_disp_ ## name(int id) \
+	{ \
+		display_hints(xap_derive_return_disp) \
+		return NULL; \
+	} \
+	\
+	xap_declare_fprint_usage(name) \
+	{ \
+		int cnt = 0; \
+		char * (*get_desc)(int) = xap_get_desc_ ## name; \
+		char * (*get_disp)(int) = xap_get_disp_ ## name; \
+		cnt += fputs("\npositional arguments:\n", stream); \
+		arguments(xap_derive_fprint_positional_help) \
+		cnt += fputs("\nkeyword arguments:\n", stream); \
+		arguments(xap_derive_fprint_keyword_help) \
+		return cnt; \
+	}
+
+#ifdef XAP_POSIX
+/* response files
+ *
+ * @path arguments are replaced by the arguments listed in path, which are
+ * separated by NUL bytes if the file contains any and by newlines otherwise
+ * (empty lines are skipped); response files may list other response files up
+ * to XAP_RESPONSE_DEPTH levels deep, a lone "@" is left alone, and nothing
+ * after the first "--" is expanded, whether it is in argv or in a file
+ *
+ * NUL-delimited files are mmap()ed read-only and the arguments point into the
+ * mappings without copying anything. Newline-delimited files are copied into
+ * memory once so that the newlines can be replaced, as are pipes, FIFOs and
+ * other files that cannot be mapped. Neither the original argv nor its
+ * strings are modified.
+ */
+#ifndef XAP_RESPONSE_DEPTH
+	#define XAP_RESPONSE_DEPTH 8
+#endif
+
+typedef struct xap_response_file {
+	char * data;
+	size_t size;
+	char * tail;  /* copy of an unterminated last argument if it fills a page */
+	bool copied;  /* data is malloc()ed and NUL-terminated rather than mapped */
+} xap_response_file_t;
+
+typedef struct xap_response_files {
+	int argc;
+	char ** argv;
+	size_t capacity;
+	size_t n_files;
+	xap_response_file_t * files;
+} xap_response_files_t;
+
+static inline
+void xap_free_response_files(xap_response_files_t * responses)
+{
+	for (size_t k = 0; k < responses->n_files; k++) {
+		if (responses->files[k].copied) free(responses->files[k].data);
+		else munmap(responses->files[k].data, responses->files[k].size);
+		free(responses->files[k].tail);
+	}
+	free(responses->files);
+	free(responses->argv);
+	*responses = (xap_response_files_t){ 0 };
+}
+
+static inline
+xap_error_t xap_push_response_arg(xap_response_files_t * responses, char * arg)
+{
+	if ((size_t)responses->argc + 1 >= responses->capacity) {
+		size_t capacity = responses->capacity ? 2 * responses->capacity : 64;
+		char ** argv = realloc(responses->argv, capacity * sizeof(char *));
+		if (argv == NULL) return "out of memory";
+		responses->argv = argv;
+		responses->capacity = capacity;
+	}
+	responses->argv[responses->argc++] = arg;
+	responses->argv[responses->argc] = NULL;
+	return NULL;
+}
+
+/* everything up to the end of fd, NUL-terminated, or NULL on failure */
+static inline
+char * xap_read_all(int fd, size_t * size)
+{
+	size_t capacity = 4096, used = 0;
+	char * data = malloc(capacity);
+	while (data != NULL) {
+		if (capacity - used < 2) {
+			char * more = capacity <= SIZE_MAX / 2 ? realloc(data, 2 * capacity) : NULL;
+			if (more == NULL) break;
+			data = more;
+			capacity *= 2;
+		}
+		ssize_t got = read(fd, data + used, capacity - used - 1);
+		if (got < 0 && errno == EINTR) continue;
+		if (got < 0) break;
+		if (got == 0) {
+			data[used] = '\0';
+			*size = used;
+			return data;
+		}
+		used += got;
+	}
+	free(data);
+	return NULL;
+}
+
+static inline
+xap_error_t xap_map_response_file(xap_response_files_t * responses, char const * path, xap_response_file_t ** p_file)
+{
+	xap_response_file_t * files = realloc(responses->files, (responses->n_files + 1) * sizeof(*files));
+	if (files == NULL) return "out of memory";
+	responses->files = files;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return "cannot open response file";
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return "cannot open response file";
+	}
+	xap_response_file_t file = { .data = NULL, .size = 0, .tail = NULL, .copied = false };
+	xap_error_t error = NULL;
+	if (!S_ISREG(st.st_mode)) {
+		/* pipes and devices have no size to go by */
+		file.copied = true;
+		file.data = xap_read_all(fd, &file.size);
+		if (file.data == NULL) error = "cannot read response file";
+	}
+	else if (st.st_size > 0) {
+		file.size = st.st_size;
+		file.data = mmap(NULL, file.size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (file.data == MAP_FAILED) {
+			file.data = NULL;
+			error = "cannot map response file";
+		}
+		else if (memchr(file.data, '\0', file.size) == NULL) {
+			/* replacing the newlines in a private mapping would duplicate
+			 * every page anyway, so copy once */
+			char * copy = malloc(file.size + 1);
+			if (copy != NULL) {
+				memcpy(copy, file.data, file.size);
+				copy[file.size] = '\0';
+			}
+			munmap(file.data, file.size);
+			file.data = copy;
+			file.copied = true;
+			if (copy == NULL) error = "out of memory";
+		}
+	}
+	close(fd);
+	if (error != NULL || file.size == 0) {
+		if (file.copied) free(file.data);
+		return error;  /* nothing to keep for empty files */
+	}
+	files[responses->n_files] = file;
+	*p_file = files + responses->n_files++;
+	return NULL;
+}
+
+/* *expand is cleared by the first "--", at any depth */
+static inline
+xap_error_t xap_expand_response_file(xap_response_files_t * responses, char const * path, int depth, bool * expand)
+{
+	if (depth >= XAP_RESPONSE_DEPTH) return "response files nested too deeply";
+	xap_response_file_t * file = NULL;
+	xap_error_t error = xap_map_response_file(responses, path, &file);
+	if (error || file == NULL) return error;
+
+	/* file may move as nested files are added */
+	size_t index = file - responses->files, size = file->size;
+	char * data = file->data, * end = data + size;
+	char delimiter = memchr(data, '\0', size) ? '\0' : '\n';
+	long page = sysconf(_SC_PAGESIZE);
+	bool copied = file->copied;
+	for (char * arg = data; arg < end; ) {
+		char * next = memchr(arg, delimiter, end - arg);
+		if (next == NULL) {
+			next = end;
+			if (!copied && page > 0 && size % page == 0) {
+				/* no room for a terminator in the mapping */
+				char * tail = malloc(end - arg + 1);
+				if (tail == NULL) return "out of memory";
+				memcpy(tail, arg, end - arg);
+				tail[end - arg] = '\0';
+				responses->files[index].tail = tail;
+				arg = tail;
+			}
+		}
+		else if (delimiter == '\n') {
+			*next = '\0';
+			if (next > arg && next[-1] == '\r') next[-1] = '\0';
+		}
+		if (delimiter == '\0' || arg[0] != '\0') {
+			if (strcmp(arg, "--") == 0) *expand = false;
+			error = *expand && arg[0] == '@' && arg[1] != '\0'
+				? xap_expand_response_file(responses, arg + 1, depth + 1, expand)
+				: xap_push_response_arg(responses, arg);
+			if (error) return error;
+		}
+		arg = next + 1;
+	}
+	return NULL;
+}
+
+/* on success, *argc and *argv refer to the expanded arguments if there were
+ * any @path arguments; they stay valid until xap_free_response_files() */
+static inline
+xap_error_context_t xap_expand_response_files(int * argc, char *** argv, xap_response_files_t * responses)
+{
+	xap_error_context_t ctx = { 0 };
+	*responses = (xap_response_files_t){ 0 };
+	int n = 0;
+	while (n < *argc && strcmp((*argv)[n], "--") != 0 && ((*argv)[n][0] != '@' || (*argv)[n][1] == '\0')) n++;
+	if (n == *argc || strcmp((*argv)[n], "--") == 0) return ctx;
+
+	bool expand = true;
+	for (int i = 0; i < *argc; i++) {
+		char * arg = (*argv)[i];
+		ctx.argument = arg;
+		if (strcmp(arg, "--") == 0) expand = false;
+		ctx.error = expand && arg[0] == '@' && arg[1] != '\0'
+			? xap_expand_response_file(responses, arg + 1, 0, &expand)
+			: xap_push_response_arg(responses, arg);
+		if (ctx.error) {
+			xap_free_response_files(responses);
+			return ctx;
+		}
+	}
+	*argc = responses->argc;
+	*argv = responses->argv;
+	return ctx;
+}
+#endif
+
+/* cached output
+ *
+ * usage and help text only depends on the X-macros, so it can be rendered
+ * once into memory and replayed with a single fwrite() afterwards; the first
+ * call prints directly, so a process that prints once pays nothing for this
+ */
+typedef struct xap_text {
+	xap_once_t printed;  /* first call done */
+	xap_once_t ready;
+	char * data;  /* NULL if rendering failed; never freed */
+	size_t size;
+} xap_text_t;
+
+static inline
+void xap_render_text(xap_text_t * text, int (*fprint)(FILE *))
+{
+#ifdef XAP_HAVE_MEMSTREAM
+	FILE * memory = open_memstream(&text->data, &text->size);
+	if (memory == NULL) return;
+	fprint(memory);
+	if (fclose(memory) != 0) {
+		free(text->data);
+		text->data = NULL;
+	}
+#else
+	(void) text;
+	(void) fprint;
+#endif
+}
+
+static inline
+int xap_fprint_text(xap_text_t * text, int (*fprint)(FILE *), FILE * stream)
+{
+	if (xap_once_begin(&text->printed)) return fprint(stream);
+	if (!xap_once_done(&text->ready)) {
+		if (!xap_once_begin(&text->ready)) return fprint(stream); /* being rendered */
+		xap_render_text(text, fprint);
+		xap_once_end(&text->ready);
+	}
+	if (text->data == NULL) return fprint(stream);
+	size_t n = fwrite(text->data, 1, text->size, stream);
+	if (n < text->size) return -1;
+	return n > INT_MAX ? INT_MAX : (int) n;
+}
+
+/* cache the concatenated output of one or more fprint functions; e.g.,
+ *     xap_define_cached_fprint(fprint_full_help, fprint_usage, fprint_help);
+ */
+#define xap_define_cached_fprint(name, ...) \
+	int xap_render_ ## name(FILE * stream) \
+	{ \
+		int (*fprints[])(FILE *) = { __VA_ARGS__ }; \
+		int cnt = 0; \
+		for (size_t k = 0; k < sizeof(fprints) / sizeof(fprints[0]); k++) \
+			cnt += fprints[k](stream); \
+		return cnt; \
+	} \
+	\
+	xap_declare_fprint_usage(name) \
+	{ \
+		static xap_text_t text; \
+		return xap_fprint_text(&text, xap_render_ ## name, stream); \
+	}
+
+/* subcommands
+ *
+ * commands(_) lists _(cmd, struct_type, parser, fprint_usage, fprint_help),
+ * where cmd is the string that selects the parser; the generated dispatcher
+ * looks argv[1] up in a sorted index and hands argv + 1 to the parser, so the
+ * subcommand is its argv[0]. An optional sixth column names a function
+ * void init(struct_type *) that sets up the struct (defaults, arenas for
+ * list and lazy fields) instead of it being zeroed.
+ */
+#define xap_command_zero(args) memset((args), 0, sizeof(*(args)))
+#define xap_command_first(first, ...) first
+/* init, or xap_command_zero if the row has no sixth column */
+#define xap_command_init(...) xap_command_first(__VA_ARGS__ xap_command_zero, ~)
+
+#define xap_derive_command_enum(name, cmd, struct_type, parser, fprint_usage, fprint_help, ...) \
+	name ## _ ## parser,
+
+#define xap_derive_command_member(name, cmd, struct_type, parser, fprint_usage, fprint_help, ...) \
+	struct_type parser;
+
+#define xap_derive_command_name(name, cmd, struct_type, parser, fprint_usage, fprint_help, ...) \
+	[name ## _ ## parser] = cmd,
+
+#define xap_derive_command_parse(name, cmd, struct_type, parser, fprint_usage, fprint_help, ...) \
+	case name ## _ ## parser: \
+		xap_command_init(__VA_ARGS__)(&args->parser); \
+		ctx = parser(&sub_argc, argv + 1, &args->parser); \
+		break;
+
+#define xap_derive_command_usage(name, cmd, struct_type, parser, fprint_usage, fprint_help, ...) \
+	case name ## _ ## parser: return fprint_usage(stream);
+
+#define xap_derive_command_help(name, cmd, struct_type, parser, fprint_usage, fprint_help, ...) \
+	case name ## _ ## parser: return fprint_help(stream);
+
+#define xap_derive_command_list(name, cmd, struct_type, parser, fprint_usage, fprint_help, ...) \
+	cnt += fprintf(stream, "  %s\n", cmd);
+
+/* commands(_) only passes the row to _, so the derivations that need the name
+ * of the dispatcher get it by having each _ expand to the deferred tokens
+ * derive ( name , ... xap_command_row and the row to
+ *     derive(name, cmd, struct_type, parser, fprint_usage, fprint_help, [init,])
+ * which xap_command_eval() then rescans; the trailing comma leaves the
+ * variable arguments empty rather than missing for rows without init
+ */
+#define xap_command_empty()
+#define xap_command_lparen() (
+#define xap_command_comma() ,
+#define xap_command_row(...) __VA_ARGS__,)
+#define xap_command_bind(derive, name) \
+	derive xap_command_lparen xap_command_empty() () name xap_command_comma xap_command_empty() () xap_command_row
+#define xap_command_eval(...) __VA_ARGS__
+#define xap_each_command(name, commands, derive) \
+	xap_command_eval(commands(xap_command_bind(derive, name)))
+
+/* enum name_command (name_none, then name_<parser> for each entry) and union
+ * name_args (a member named after each parser) */
+#define xap_declare_commands(name, commands) \
+	enum name ## _command { name ## _none, xap_each_command(name, commands, xap_derive_command_enum) }; \
+	union name ## _args { xap_each_command(name, commands, xap_derive_command_member) }; \
+	xap_error_context_t name(int * argc, char ** argv, enum name ## _command * command, union name ## _args * args); \
+	int name ## _fprint_usage(enum name ## _command command, FILE * stream); \
+	int name ## _fprint_help(enum name ## _command command, FILE * stream)
+
+/* only the selected member of args is initialized, by its init function or
+ * to zero, and *argc becomes one more than what the parser leaves */
+#define xap_define_commands(name, commands) \
+	xap_error_context_t name(int * argc, char ** argv, enum name ## _command * command, union name ## _args * args) \
+	{ \
+		static char const * const names[] = { NULL, xap_each_command(name, commands, xap_derive_command_name) }; \
+		static unsigned short sorted[sizeof(names) / sizeof(names[0])]; \
+		static xap_lopt_index_t index = { .sorted = sorted }; \
+		xap_error_context_t ctx = { 0 }; \
+		*command = name ## _none; \
+		if (*argc < 2) { \
+			ctx.error = "argument required"; \
+			ctx.argument = "command"; \
+			return ctx; \
+		} \
+		int found = xap_find_lopt(&index, names, sizeof(names) / sizeof(names[0]), argv[1], strlen(argv[1]), XAP_ALLOW_ABBREVIATIONS); \
+		if (found <= 0) { \
+			ctx.error = found < 0 ? "ambiguous abbreviation" : "unknown command"; \
+			ctx.argument = argv[1]; \
+			return ctx; \
+		} \
+		*command = found; \
+		int sub_argc = *argc - 1; \
+		switch (*command) { \
+			xap_each_command(name, commands, xap_derive_command_parse) \
+			default: break; \
+		} \
+		*argc = sub_argc + 1; \
+		return ctx; \
+	} \
+	\
+	int name ## _fprint_usage(enum name ## _command command, FILE * stream) \
+	{ \
+		switch (command) { \
+			xap_each_command(name, commands, xap_derive_command_usage) \
+			default: break; \
+		} \
+		int cnt = 0; \
+		cnt += fputs("\ncommands:\n", stream); \
+		xap_each_command(name, commands, xap_derive_command_list) \
+		return cnt; \
+	} \
+	\
+	int name ## _fprint_help(enum name ## _command command, FILE * stream) \
+	{ \
+		switch (command) { \
+			xap_each_command(name, commands, xap_derive_command_help) \
+			default: return 0; \
+		} \
+	}
+
+/* table-driven parsers
+ *
+ * xap_define_parser and friends expand every argument several times, which
+ * adds up for large option sets; xap_define_table instead turns the X-macros
+ * into static const descriptor arrays, and the functions below interpret any
+ * such table, so the code is shared by every parser
+ *
+ * options[] and the lookup tables are indexed by the same states as in
+ * xap_parser_fsm, with options[0] (UNKNOWN) unused
+ */
+typedef struct xap_option {
+	int id;                 /* xap_derive_id(sopt, lopt); > 0 for keywords */
+	char const * lopt;
+	char const * name;      /* field name, for usage messages without hints */
+	size_t offset;          /* of the field in the structure */
+	size_t size;            /* of the field */
+	xap_assign conv;
+	bool repeatable;        /* xap_list_t fields */
+	bool lazy;              /* xap_lazy_t fields */
+	bool rest;              /* xap_rest_t fields */
+	bool toggle;            /* converted by xap_toggle */
+} xap_option_t;
+
+typedef struct xap_hint {
+	int id;
+	char const * disp;
+	char const * desc;
+} xap_hint_t;
+
+typedef struct xap_table {
+	size_t n_states;
+	xap_option_t const * options;
+	unsigned short const * sopt_states;
+	unsigned short const * position_states; /* by position + 1 */
+	size_t n_positions;
+	char const * const * lopt_names;
+	char const * const * argument_names;
+	size_t n_required, n_stop_after, n_hints;
+	bool abbreviate;  /* XAP_ALLOW_ABBREVIATIONS where the table was defined */
+	int const * required_ids;
+	int const * stop_after_ids;
+	xap_hint_t const * hints;
+	/* built on first use */
+	xap_lopt_index_t * lopt_index;
+	xap_once_t * masks_ready;
+	xap_bits_t * required_mask;
+	xap_bits_t * stop_after_mask;
+	xap_instrument(xap_stats_t * stats;)
+} xap_table_t;
+
+#define xap_derive_option(sopt, lopt, type, name, arry, conv) \
+	[xap_derive_state_name(sopt, lopt, type, name, arry, conv)] = { \
+		xap_derive_id(sopt, lopt), \
+		lopt, \
+		#name #arry, \
+		offsetof(xap_table_struct, name), \
+		sizeof(((xap_table_struct *)NULL)->name), \
+		(xap_assign)(void (*)(void))conv, \
+		xap_is_list(((xap_table_struct *)NULL)->name), \
+		xap_is_lazy(((xap_table_struct *)NULL)->name), \
+		xap_is_rest(((xap_table_struct *)NULL)->name), \
+		xap_is_toggle(conv), \
+	},
+
+#define xap_derive_hint(sopt, lopt, disp, desc) \
+	{ xap_derive_id(sopt, lopt), disp, desc },
+
+#define xap_declare_table(name) \
+	xap_table_t const * name(void)
+
+/* words in a parsed bitset for the table defined as name, for xap_route_t */
+#define xap_table_parsed_words(name) \
+	xap_parsed_words_ ## name
+
+/* the states only exist inside the function, hence the accessor */
+#define xap_define_table(name, struct_type, arguments, stop_after, required, display_hints) \
+	enum { xap_table_parsed_words(name) = xap_bits_words(xap_count(arguments) + 1) }; \
+	xap_declare_table(name) \
+	{ \
+		typedef struct_type xap_table_struct; \
+		enum state { \
+			UNKNOWN, \
+			arguments(xap_derive_state_name_comma) \
+			NEXT_ARG \
+		}; \
+		static const xap_option_t options[NEXT_ARG] = { arguments(xap_derive_option) }; \
+		static const int required_ids[] = xap_ids(required), stop_after_ids[] = xap_ids(stop_after); \
+		static const xap_hint_t hints[] = { display_hints(xap_derive_hint) }; \
+		static char const * const argument_names[NEXT_ARG] = { arguments(xap_derive_argument_name) }; \
+		static xap_bits_t required_mask[xap_bits_words(NEXT_ARG)], stop_after_mask[xap_bits_words(NEXT_ARG)]; \
+		static xap_once_t masks_ready; \
+		xap_sopt_table(arguments) \
+		xap_lopt_table(arguments) \
+		xap_position_table(arguments) \
+		xap_instrument(xap_stats_vars(#name, arguments)) \
+		static const xap_table_t table = { \
+			.n_states = NEXT_ARG, \
+			.options = options, \
+			.sopt_states = sopt_states, \
+			.position_states = position_states, \
+			.n_positions = sizeof(position_states) / sizeof(position_states[0]) - 1, \
+			.lopt_names = lopt_names, \
+			.argument_names = argument_names, \
+			.n_required = xap_count(required), \
+			.n_stop_after = xap_count(stop_after), \
+			.n_hints = sizeof(hints) / sizeof(hints[0]), \
+			.abbreviate = XAP_ALLOW_ABBREVIATIONS, \
+			.required_ids = required_ids, \
+			.stop_after_ids = stop_after_ids, \
+			.hints = hints, \
+			.lopt_index = &lopt_index, \
+			.masks_ready = &masks_ready, \
+			.required_mask = required_mask, \
+			.stop_after_mask = stop_after_mask, \
+			xap_instrument(.stats = &stats_data,) \
+		}; \
+		return &table; \
+	}
+
+static inline
+void xap_table_prepare(xap_table_t const * table)
+{
+	if (xap_once_done(table->masks_ready)) return;
+	if (xap_once_begin(table->masks_ready)) {
+		for (size_t state = 1; state < table->n_states; state++) {
+			int id = table->options[state].id;
+			for (size_t k = 0; k < table->n_required; k++)
+				if (table->required_ids[k] == id) xap_bit_set(table->required_mask, state);
+			for (size_t k = 0; k < table->n_stop_after; k++)
+				if (table->stop_after_ids[k] == id) xap_bit_set(table->stop_after_mask, state);
+		}
+		xap_once_end(table->masks_ready);
+	}
+	xap_once_wait(table->masks_ready); /* another thread is building them */
+}
+
+static inline
+size_t xap_table_position(xap_table_t const * table, int position)
+{
+	return (size_t)position < table->n_positions ? table->position_states[position + 1] : 0;
+}
+
+static inline
+xap_hint_t const * xap_table_hint(xap_table_t const * table, int id)
+{
+	for (size_t k = 0; k < table->n_hints; k++)
+		if (table->hints[k].id == id) return table->hints + k;
+	return NULL;
+}
+
+/* one of the tables parsed together by xap_route_run(); arguments go to the
+ * first table that has a use for them */
+typedef struct xap_route {
+	xap_table_t const * table;
+	void * args;
+	int position;         /* zero to start with */
+	xap_bits_t * parsed;  /* xap_bits_words(table->n_states) zeroed words */
+	size_t n_parsed;      /* words in parsed, checked if not zero */
+} xap_route_t;
+
+/* an argument that no table had a use for and its index in argv */
+typedef struct xap_leftover {
+	int index;
+	char * arg;
+} xap_leftover_t;
+
+/* state that carries over between xap_route_run() calls on consecutive
+ * slices of the same command line */
+typedef struct xap_table_run {
+	bool more;            /* input: more arguments will follow argv[*argc - 1] */
+	bool defer_check;     /* input: leave the required arguments to the caller */
+	bool done;            /* "--", a stop_after argument or an error was seen */
+	int next;             /* output: first argument in argv not looked at */
+	int offset;           /* index of argv[0] in the whole command line */
+	xap_list_t * leftovers; /* of xap_leftover_t, if not NULL */
+	xap_rest_t * rest;    /* output: the xap_rest_t field that ended parsing */
+} xap_table_run_t;
+
+static inline
+xap_error_t xap_route_leftovers(xap_table_run_t * run, int begin, int end, char ** argv)
+{
+	if (run->leftovers == NULL) return NULL;
+	for (int k = begin; k < end; k++) {
+		xap_leftover_t * item = xap_list_append(run->leftovers, sizeof(xap_leftover_t), _Alignof(xap_leftover_t));
+		if (item == NULL) return "arena is full";
+		*item = (xap_leftover_t){ .index = run->offset + k, .arg = argv[k] };
+	}
+	return NULL;
+}
+
+/* parse the arguments that start before argv[limit] (converters may still
+ * consume the ones after it); the required arguments are only checked once
+ * there are no more, and, as usual, argv is compacted before returning */
+static inline
+xap_error_context_t xap_route_run(size_t n_routes, xap_route_t * routes, xap_table_run_t * run, int * argc, char ** argv, int limit)
+{
+	xap_error_context_t ctx = { 0 };
+	for (size_t r = 0; r < n_routes; r++) {
+		if (routes[r].n_parsed != 0 && routes[r].n_parsed < xap_bits_words(routes[r].table->n_states)) {
+			ctx.error = "parsed bitset too small";
+			run->done = true;
+			return ctx;
+		}
+		xap_table_prepare(routes[r].table);
+	}
+	/* the steps that are not specific to one table go to the first one */
+	xap_instrument(xap_stats_t * stats = routes[0].table->stats; size_t steps = routes[0].table->n_states; uint64_t conv_start;)
+	xap_instrument(xap_counter_add(stats->parses, 1);)
+
+	bool dirty = false;
+	int i = 0, n_marked = 0, consumed, state, current = -1;
+	char * equal_sign = NULL;
+	int rest_start = 0;
+	xap_route_t * route;
+	xap_arg_classes_t classes;
+	classes.first = classes.count = 0;
+	for (;;) {
+		if (!dirty || argv[i][0] == '\0') {
+			if (i >= limit && run->more) goto done; /* the rest comes later */
+			if (i >= limit) break; /* no more arguments */
+			current = i;
+			xap_instrument(xap_stats_state(stats, steps + XAP_STEP_NEXT_ARG, i, *argc, argv);)
+			equal_sign = NULL;
+			ctx.argument = argv[i];
+			ctx.n_parameters = 0;
+			dirty = false;
+			xap_arg_class_t const * arg_class = xap_classify(&classes, *argc, argv, i);
+			if (arg_class->kind == XAP_ARG_POSITIONAL) { /* not a keyword */
+				xap_instrument(xap_stats_state(stats, steps + XAP_STEP_POSITIONAL, i, *argc, argv);)
+				/* every table asked uses up the position, taking it or not */
+				for (route = routes; route < routes + n_routes; route++) {
+					state = xap_table_position(route->table, route->position++);
+					if (state != 0) break;
+				}
+				if (route == routes + n_routes) goto skip;
+				goto set;
+			}
+			if (arg_class->kind == XAP_ARG_END) { /* "--" */
+				if ((ctx.error = xap_route_leftovers(run, i, *argc, argv))) goto stop;
+				break;
+			}
+			if (arg_class->kind == XAP_ARG_LOPT) { /* arg in --arg */
+				xap_instrument(xap_stats_state(stats, steps + XAP_STEP_LOPT, i, *argc, argv);)
+				char * lopt = argv[i] + 2;
+				size_t lopt_len = arg_class->length;
+				for (route = routes; route < routes + n_routes; route++) {
+					xap_table_t const * table = route->table;
+					state = xap_find_lopt(table->lopt_index, table->lopt_names, table->n_states, lopt, lopt_len, table->abbreviate);
+					if (state != 0) break;
+				}
+				if (state < 0) {
+					ctx.error = "ambiguous abbreviation";
+					goto stop;
+				}
+				if (route == routes + n_routes) goto skip;
+				if (lopt[lopt_len] == '=') {
+					equal_sign = lopt + lopt_len;
+					argv[i] = equal_sign + 1;
+				}
+				else if ((ctx.error = xap_mark_args(&i, 1, *argc, argv))) goto stop;
+				else n_marked++;
+				goto set;
+			}
+			argv[i]++; /* x in -xyz */
+		}
+
+		xap_instrument(xap_stats_state(stats, steps + XAP_STEP_SOPT, i, *argc, argv);)
+		for (route = routes; route < routes + n_routes; route++) {
+			state = route->table->sopt_states[(unsigned char)argv[i][0]];
+			if (state != 0) break;
+		}
+		if (route == routes + n_routes) {
+			argv[i] = ctx.argument;
+			dirty = false;
+			goto skip;
+		}
+		argv[i]++;
+		dirty = argv[i][0] != '\0';
+		if (!dirty && i != *argc - 1) {
+			if ((ctx.error = xap_mark_args(&i, 1, *argc, argv))) goto stop;
+			n_marked++;
+		}
+
+	set:
+		if (!route->table->options[state].repeatable && xap_bit_test(route->parsed, state)) {
+			ctx.error = "already parsed";
+			goto stop;
+		}
+		xap_option_t const * option = route->table->options + state;
+		if (option->rest) {
+			/* the "" left of -x when it ends argv is not part of the rest */
+			if (equal_sign == NULL && i == current && i < *argc && argv[i][0] == '\0') {
+				if ((ctx.error = xap_mark_args(&i, 1, *argc, argv))) goto stop;
+				n_marked++;
+			}
+			run->rest = (xap_rest_t *)((char *)route->args + option->offset);
+			rest_start = i - n_marked;
+			xap_bit_set(route->parsed, state);
+			break;
+		}
+		xap_instrument(xap_stats_state(route->table->stats, state, i, *argc, argv); conv_start = xap_now_ns();)
+		ctx.error = option->conv(*argc - i, argv + i, (char *)route->args + option->offset, &consumed);
+		xap_instrument(xap_counter_add(route->table->stats->conv_ns[state], xap_now_ns() - conv_start);)
+		ctx.n_parameters = consumed > 0 ? consumed - (equal_sign != NULL) : 0;
+		ctx.parameters = argv + i - n_marked + (equal_sign != NULL);
+		if (ctx.error) goto stop;
+		dirty &= consumed == 0;
+		if ((ctx.error = xap_mark_args(&i, consumed, *argc, argv))) goto stop;
+		n_marked += consumed;
+		if (consumed == 0 && i == current && i < *argc && argv[i][0] == '\0') { /* what is left of -x or --x= */
+			if ((ctx.error = xap_mark_args(&i, 1, *argc, argv))) goto stop;
+			n_marked++;
+		}
+		xap_bit_set(route->parsed, state);
+		if (xap_bit_test(route->table->stop_after_mask, state)) {
+			ctx.error = xap_route_leftovers(run, i, *argc, argv);
+			goto stop;
+		}
+		continue;
+
+	skip:
+		if ((ctx.error = xap_route_leftovers(run, i, i + 1, argv))) goto stop;
+		i++;
+	}
+
+	for (route = routes; route < routes + n_routes && !run->defer_check; route++) {
+		xap_table_t const * table = route->table;
+		xap_instrument(xap_stats_state(table->stats, table->n_states + XAP_STEP_CHECK, i, *argc, argv);)
+		size_t missing = xap_first_missing_bit(table->required_mask, route->parsed, xap_bits_words(table->n_states));
+		if (missing != 0) {
+			ctx.error = "argument required";
+			ctx.argument = (char *)table->argument_names[missing];
+			ctx.n_parameters = 0;
+			break;
+		}
+	}
+stop:
+	run->done = true;
+done:
+	run->next = i - n_marked;
+	run->offset += i;
+	xap_instrument(xap_stats_compact(stats, n_marked, *argc, argv);)
+	xap_compact_args(argc, argv);
+	if (run->rest != NULL) {
+		*run->rest = (xap_rest_t){ *argc - rest_start, argv + rest_start };
+		*argc = rest_start;
+	}
+	return ctx;
+}
+
+/* the same syntax and argc/argv contract as the xap_define_parser functions */
+static inline
+xap_error_context_t xap_table_parse(xap_table_t const * table, int * argc, char ** argv, void * args)
+{
+	xap_bits_t parsed[xap_bits_words(table->n_states)];
+	memset(parsed, 0, sizeof(parsed));
+	xap_route_t route = { .table = table, .args = args, .parsed = parsed };
+	xap_table_run_t run = { 0 };
+	return xap_route_run(1, &route, &run, argc, argv, *argc);
+}
+
+/* the table version of xap_define_validate_all */
+static inline
+xap_error_context_t xap_table_validate_all(xap_table_t const * table, void * args)
+{
+	xap_error_context_t ctx = { 0 };
+	for (size_t state = 1; state < table->n_states; state++) {
+		if (!table->options[state].lazy) continue;
+		xap_lazy_t * lazy = (xap_lazy_t *)((char *)args + table->options[state].offset);
+		if (xap_lazy_failed(lazy)) {
+			ctx.error = lazy->error;
+			ctx.argument = (char *)table->argument_names[state];
+			ctx.n_parameters = lazy->argc;
+			ctx.parameters = lazy->argv;
+			break;
+		}
+	}
+	return ctx;
+}
+
+/* parse argv in one pass for several tables at once, each argument going to
+ * the first one that knows it, instead of calling their parsers one after
+ * the other; arguments that none of them takes are appended to leftovers */
+static inline
+xap_error_context_t xap_route_parse(size_t n_routes, xap_route_t * routes, int * argc, char ** argv, xap_list_t * leftovers)
+{
+	xap_table_run_t run = { .leftovers = leftovers };
+	return xap_route_run(n_routes, routes, &run, argc, argv, *argc);
+}
+
+/* whether state is given a value, i.e., is not a flag: a keyword converted
+ * by xap_toggle or with an empty display name in the hints */
+static inline
+bool xap_table_takes_value(xap_table_t const * table, size_t state)
+{
+	xap_option_t const * option = table->options + state;
+	xap_hint_t const * hint = xap_table_hint(table, option->id);
+	if (hint != NULL && hint->disp != NULL && hint->disp[0] == '\0') return false;
+	return !option->toggle;
+}
+
+#ifdef XAP_POSIX
+/* layered sources
+ *
+ * fields not given in argv are taken from the environment (PREFIX_LONGNAME,
+ * upper case, with '-' as '_') and then from a file of key=value lines keyed
+ * by long option; whatever is given nowhere keeps the value it had before
+ */
+typedef struct xap_layers {
+	char const * env_prefix;    /* NULL to ignore the environment */
+	char const * config_path;   /* NULL for no config file */
+	xap_response_files_t files; /* keeps the config file mapped */
+	char * value;               /* the one an error refers to */
+} xap_layers_t;
+
+/* frees the config file, after which no string taken from it can be used */
+static inline
+void xap_free_layers(xap_layers_t * layers)
+{
+	xap_free_response_files(&layers->files);
+}
+
+static inline
+bool xap_is_false(char const * value)
+{
+	return strcmp(value, "0") == 0 || strcmp(value, "false") == 0
+		|| strcmp(value, "no") == 0 || strcmp(value, "off") == 0;
+}
+
+/* one key=value line of a config file, from line up to eol */
+static inline
+xap_error_context_t xap_read_config_line(xap_table_t const * table, char * line, char * eol, char ** values)
+{
+	xap_error_context_t ctx = { 0 };
+	while (line < eol && (*line == ' ' || *line == '\t')) line++;
+	while (eol > line && (eol[-1] == ' ' || eol[-1] == '\t' || eol[-1] == '\r')) eol--;
+	if (line == eol || *line == '#') return ctx;
+	char * equal_sign = memchr(line, '=', eol - line);
+	if (equal_sign == NULL) {
+		*eol = '\0';
+		ctx.error = "expected key=value";
+		ctx.argument = line;
+		return ctx;
+	}
+	char * key_end = equal_sign, * value = equal_sign + 1;
+	while (key_end > line && (key_end[-1] == ' ' || key_end[-1] == '\t')) key_end--;
+	while (value < eol && (*value == ' ' || *value == '\t')) value++;
+	int state = xap_find_lopt(table->lopt_index, table->lopt_names, table->n_states, line, key_end - line, false);
+	*key_end = '\0';
+	*eol = '\0';
+	if (state <= 0) {
+		ctx.error = "unknown key";
+		ctx.argument = line;
+		return ctx;
+	}
+	values[state] = value;
+	return ctx;
+}
+
+/* the last value of each key, NUL-terminated in place */
+static inline
+xap_error_context_t xap_read_config(xap_table_t const * table, xap_layers_t * layers, char ** values)
+{
+	xap_error_context_t ctx = { 0 };
+	xap_response_file_t * file = NULL;
+	if (xap_map_response_file(&layers->files, layers->config_path, &file) != NULL
+		|| (file != NULL && memchr(file->data, '\0', file->size) != NULL)) {
+		ctx.error = "cannot read config file";
+		ctx.argument = (char *)layers->config_path;
+		return ctx;
+	}
+	if (file == NULL) return ctx; /* empty */
+
+	/* without NUL bytes, the file is a terminated copy */
+	char * data = file->data, * end = data + file->size;
+	for (char * line = data; line < end && ctx.error == NULL; ) {
+		char * eol = memchr(line, '\n', end - line);
+		if (eol == NULL) eol = end;
+		ctx = xap_read_config_line(table, line, eol, values);
+		line = eol + 1;
+	}
+	return ctx;
+}
+
+/* argv, then the environment, then the config file; each field is converted
+ * once, from the first of them that has it, before the required arguments
+ * are checked. Strings taken from the config file stay valid until
+ * xap_free_layers(). */
+static inline
+xap_error_context_t xap_table_parse_layered(xap_table_t const * table, xap_layers_t * layers, int * argc, char ** argv, void * args)
+{
+	xap_bits_t parsed[xap_bits_words(table->n_states)];
+	memset(parsed, 0, sizeof(parsed));
+	xap_route_t route = { .table = table, .args = args, .parsed = parsed };
+	xap_table_run_t run = { .defer_check = true };
+	xap_error_context_t ctx = xap_route_run(1, &route, &run, argc, argv, *argc);
+	if (ctx.error) return ctx;
+	for (size_t k = 0; k < xap_bits_words(table->n_states); k++)
+		if (parsed[k] & table->stop_after_mask[k]) return ctx;
+
+	char * values[table->n_states];
+	memset(values, 0, sizeof(values));
+	if (layers->config_path != NULL) {
+		ctx = xap_read_config(table, layers, values);
+		if (ctx.error) return ctx;
+	}
+	size_t prefix_len = layers->env_prefix ? strlen(layers->env_prefix) : 0;
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		if (xap_bit_test(parsed, state) || option->lopt == NULL || option->lopt[0] == '\0' || option->rest) continue;
+		if (layers->env_prefix != NULL) {
+			size_t len = strlen(option->lopt);
+			char name[prefix_len + len + 2];
+			memcpy(name, layers->env_prefix, prefix_len);
+			name[prefix_len] = '_';
+			for (size_t k = 0; k <= len; k++) {
+				char c = option->lopt[k];
+				name[prefix_len + 1 + k] = c == '-' ? '_' : c >= 'a' && c <= 'z' ? c - 'a' + 'A' : c;
+			}
+			char * value = getenv(name);
+			if (value != NULL) values[state] = value;
+		}
+		if (values[state] == NULL) continue;
+
+		/* flags are set or cleared by the value, not switched over; other
+		 * flags (an empty display name) are only given a true value */
+		char * field = (char *)args + option->offset;
+		if (option->toggle) {
+			*(bool *)field = !xap_is_false(values[state]);
+			xap_bit_set(parsed, state);
+			continue;
+		}
+		if (!xap_table_takes_value(table, state) && xap_is_false(values[state])) {
+			xap_bit_set(parsed, state);
+			continue;
+		}
+		layers->value = values[state];
+		int consumed;
+		ctx.error = option->conv(1, &layers->value, field, &consumed);
+		if (ctx.error) {
+			ctx.argument = (char *)table->argument_names[state];
+			ctx.n_parameters = 1;
+			ctx.parameters = &layers->value;
+			return ctx;
+		}
+		xap_bit_set(parsed, state);
+	}
+
+	size_t missing = xap_first_missing_bit(table->required_mask, parsed, xap_bits_words(table->n_states));
+	if (missing != 0) {
+		ctx.error = "argument required";
+		ctx.argument = (char *)table->argument_names[missing];
+	}
+	return ctx;
+}
+#endif
+
+#ifndef XAP_STREAM_CHUNK
+#define XAP_STREAM_CHUNK 65536     /* bytes read per block; the longest argument */
+#endif
+#ifndef XAP_STREAM_WINDOW
+#define XAP_STREAM_WINDOW 1024     /* arguments handed to the parser at once */
+#endif
+#ifndef XAP_STREAM_LOOKAHEAD
+#define XAP_STREAM_LOOKAHEAD 64    /* parameters a converter can see past a window */
+#endif
+
+/* fills buffer with up to size bytes and returns the count, 0 at the end of
+ * the input or -1 on failure */
+typedef long (*xap_read_t)(void * source, char * buffer, size_t size);
+
+static inline
+long xap_read_file(void * source, char * buffer, size_t size)
+{
+	size_t got = fread(buffer, 1, size, source);
+	return got == 0 && ferror((FILE *)source) ? -1 : (long)got;
+}
+
+#ifdef XAP_POSIX
+static inline
+long xap_read_fd(void * source, char * buffer, size_t size)
+{
+	ssize_t got;
+	do got = read(*(int *)source, buffer, size); while (got < 0 && errno == EINTR);
+	return got;
+}
+#endif
+
+/* parse NUL-delimited arguments (as written by find -print0 or xargs -0) as
+ * they are read, without ever holding the whole list. The blocks the input is
+ * read into come from arena and the ones holding arguments that a converter
+ * consumed stay allocated, so the parsed values remain valid; the others are
+ * reused. Arguments the parser does not consume are passed to leftover, if
+ * given, in order and are only valid during the call. */
+static inline
+xap_error_context_t xap_table_parse_stream(xap_table_t const * table, xap_read_t reader, void * source, void * args, xap_arena_t * arena, void (*leftover)(char * arg, void * data), void * data)
+{
+	xap_error_context_t ctx;
+	xap_bits_t parsed[xap_bits_words(table->n_states)];
+	memset(parsed, 0, sizeof(parsed));
+	xap_route_t route = { .table = table, .args = args, .parsed = parsed };
+	xap_table_run_t run = { 0 };
+
+	char ** window = xap_arena_alloc(arena, (XAP_STREAM_WINDOW + 1) * sizeof(char *), _Alignof(char *));
+	char * block = xap_arena_alloc(arena, XAP_STREAM_CHUNK + 1, 1);
+	if (window == NULL || block == NULL) return (xap_error_context_t){ .error = "arena is full" };
+
+	size_t fill = 0, split = 0; /* bytes in block, start of the first partial argument */
+	int n = 0;
+	bool eof = false, pinned = false;
+	for (;;) {
+		bool can_read = !eof && fill < XAP_STREAM_CHUNK && n < XAP_STREAM_WINDOW;
+		if (can_read) {
+			long got = reader(source, block + fill, XAP_STREAM_CHUNK - fill);
+			if (got < 0) return (xap_error_context_t){ .error = "read error" };
+			eof = got == 0;
+			fill += got;
+		}
+		while (n < XAP_STREAM_WINDOW && split < fill) {
+			char * end = memchr(block + split, '\0', fill - split);
+			if (end == NULL && !eof) break;
+			if (end == NULL) { /* unterminated last argument */
+				end = block + fill++;
+				*end = '\0';
+			}
+			window[n++] = block + split;
+			split = end + 1 - block;
+		}
 
-#define xap_derive_lopt_test(sopt, lopt, type, name, arry, conv) \
-	else if (memcmp(argv[i], lopt ? lopt : "", lopt_len) == 0) { \
-		if (equal_sign != NULL) { \
-			argv[i] = equal_sign + 1; \
-		} \
-		else { \
-			ctx.error = xap_shift_args(i, 1, argc, argv); \
-			if (ctx.error) return ctx; \
-		} \
-		state = xap_derive_state_name(sopt, lopt, type, name, arry, conv); \
+		bool final = eof && split == fill;
+		can_read = !eof && fill < XAP_STREAM_CHUNK && n < XAP_STREAM_WINDOW;
+		if (!final && can_read && n <= XAP_STREAM_LOOKAHEAD) continue;
+		if (!final && n == 0) return (xap_error_context_t){ .error = "argument too long" };
+
+		ctx = (xap_error_context_t){ 0 };
+		int m = n, next = n;
+		window[n] = NULL;
+		run.more = !final;
+		if (!run.done) {
+			int limit = final ? n : n > XAP_STREAM_LOOKAHEAD ? n - XAP_STREAM_LOOKAHEAD : 1;
+			ctx = xap_route_run(1, &route, &run, &m, window, limit);
+			if (ctx.error) return ctx;
+			if (run.rest != NULL) { /* a slice of the window would not last */
+				m += run.rest->argc;
+				*run.rest = (xap_rest_t){ 0 };
+				run.rest = NULL;
+			}
+			next = run.done ? m : run.next;
+			pinned |= m < n;
+		}
+		if (leftover != NULL)
+			for (int k = 0; k < next; k++) leftover(window[k], data);
+		if (final) return ctx;
+
+		/* move what is left to the front of a block, a new one if anything
+		 * in this one was consumed or allocated after it */
+		char * carry = next < m ? window[next] : block + split;
+		size_t kept = block + fill - carry;
+		char * target = block;
+		if (pinned || arena->base + arena->used != block + XAP_STREAM_CHUNK + 1) {
+			target = xap_arena_alloc(arena, XAP_STREAM_CHUNK + 1, 1);
+			if (target == NULL) return (xap_error_context_t){ .error = "arena is full" };
+			pinned = false;
+		}
+		memmove(target, carry, kept);
+		for (int k = next; k < m; k++) window[k - next] = target + (window[k] - carry);
+		n = m - next;
+		split = block + split - carry;
+		fill = kept;
+		block = target;
 	}
-#define xap_state_lopt(arguments) \
-	case LOPT: \
-		equal_sign = strchr(argv[i], '='); \
-		lopt_len = equal_sign != NULL ? (size_t)(equal_sign - argv[i]) : strlen(argv[i]); \
-		if (0) { } \
-		arguments(xap_derive_lopt_test) \
-		else { \
-			argv[i] = ctx.argument; \
-			i++; \
-			state = NEXT_ARG; \
-			break; \
-		} \
-	break;
+}
 
-#define xap_derive_position_test(sopt, lopt, type, name, arry, conv) \
-	else if (xap_derive_id(sopt, lopt) == xap_derive_id(position, NULL)) { \
-		state = xap_derive_state_name(sopt, lopt, type, name, arry, conv); \
+static inline
+int xap_table_fprint_usage(xap_table_t const * table, FILE * stream)
+{
+	xap_table_prepare(table);
+	int cnt = 0;
+	cnt += fprintf(stream, "usage:");
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		bool is_required = xap_bit_test(table->required_mask, state);
+		xap_hint_t const * hint = xap_table_hint(table, option->id);
+		char const * display_name = hint != NULL && hint->disp != NULL ? hint->disp : option->name;
+		char const * space = display_name[0] == '\0' ? "" : " ";
+		cnt += option->lopt
+			? fprintf(stream, is_required ? " --%s%s%s" : " [--%s%s%s]", option->lopt, space, display_name)
+			: fprintf(stream, is_required ? " %s"       : " [%s]"                        , display_name);
 	}
-#define xap_state_positional(arguments) \
-	case POSITIONAL: \
-		if (0) { } \
-		arguments(xap_derive_position_test) \
-		else { \
-			i++; \
-			state = NEXT_ARG; \
-			break; \
-		} \
-		position++; \
-	break;
+	cnt += fputc('\n', stream) != EOF;
+	return cnt;
+}
 
-#define xap_derive_argument_name(sopt, lopt, type, name, arry, conv) \
-	if (ids[n] == xap_derive_id(sopt, lopt)) { \
-		argument_name = lopt ? lopt : "at position " #sopt; \
+static inline
+int xap_table_fprint_help(xap_table_t const * table, FILE * stream)
+{
+	int cnt = 0;
+	cnt += fputs("\npositional arguments:\n", stream);
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		xap_hint_t const * hint = xap_table_hint(table, option->id);
+		char const * desc = hint != NULL ? hint->desc : "---";
+		if (option->lopt || desc == NULL || desc[0] == '\0') continue;
+		cnt += fprintf(stream, "  %-20s %s\n", hint != NULL && hint->disp != NULL ? hint->disp : "", desc);
+	}
+	cnt += fputs("\nkeyword arguments:\n", stream);
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		xap_hint_t const * hint = xap_table_hint(table, option->id);
+		char const * desc = hint != NULL ? hint->desc : "---";
+		if (!option->lopt || desc == NULL || desc[0] == '\0') continue;
+		int n = 0;
+		if (xap_has_sopt(option->id))
+			n += fprintf(stream, "  -%c", option->id);
+		else
+			n += fprintf(stream, "    ");
+		if (option->lopt[0] != '\0')
+			n += fprintf(stream, xap_has_sopt(option->id) ? ", --%s  " : "  --%s  ", option->lopt);
+		else
+			n += fputs("  ", stream);
+		if (hint != NULL && hint->disp)
+			n += fprintf(stream, "%s", hint->disp);
+		cnt += n;
+		cnt += n >= 23 ? fprintf(stream, "\n%*.*s", 23, 23, "") : fprintf(stream, "%*.*s", 23 - n, 23 - n, "");
+		cnt += fprintf(stream, "%s\n", desc);
 	}
+	return cnt;
+}
 
-#define xap_derive_check_required_logic(sopt, lopt) \
-	if (ids[n] == xap_derive_id(sopt, lopt)) { \
-		ctx.error = "argument required"; \
-		ctx.argument = argument_name; \
-		ctx.n_parameters = 0; \
-		return ctx; \
+/* drop-in replacements for xap_define_parser, xap_define_fprint_usage and
+ * xap_define_fprint_help on top of a table */
+#define xap_define_table_parser(name, struct_type, table) \
+	xap_declare_parser(name, struct_type) \
+	{ \
+		return xap_table_parse(table(), argc, argv, args); \
 	}
-#define xap_state_check(arguments, required) \
-	case CHECK: \
-		for (size_t n = 0; n < n_ids; n++) { \
-			char * argument_name = "???"; \
-			arguments(xap_derive_argument_name); \
-			required(xap_derive_check_required_logic) \
-		} \
-		return ctx; \
-	break;
 
+#define xap_declare_stream_parser(name, struct_type) \
+	xap_error_context_t name(xap_read_t reader, void * source, struct_type * args, xap_arena_t * arena, void (*leftover)(char * arg, void * data), void * data)
 
-/* parser state machine */
-#define xap_parser_fsm(arguments, required) \
-	enum state { \
-		arguments(xap_derive_state_name_comma) \
-		NEXT_ARG, \
-		POSITIONAL, \
-		SOPT, \
-		LOPT, \
-		CHECK \
-	} state = NEXT_ARG; \
-	\
-	for (;;) switch (state) { \
-		xap_states_set_arg_X(arguments) \
-		xap_state_next_arg() \
-		xap_state_sopt(arguments) \
-		xap_state_lopt(arguments) \
-		xap_state_positional(arguments) \
-		xap_state_check(arguments, required) \
-		default: \
-			fprintf(stderr, "parser logic is wrong; submit a bug report\n"); \
-			exit(-1); \
+#define xap_define_table_stream_parser(name, struct_type, table) \
+	xap_declare_stream_parser(name, struct_type) \
+	{ \
+		return xap_table_parse_stream(table(), reader, source, args, arena, leftover, data); \
 	}
 
+#ifdef XAP_POSIX
+#define xap_declare_layered_parser(name, struct_type) \
+	xap_error_context_t name(xap_layers_t * layers, int * argc, char ** argv, struct_type * args)
 
-/* the parser function */
-#define xap_declare_parser(name, struct_type) \
-	xap_error_context_t name(int * argc, char ** argv, struct_type * args)
-
-#define xap_derive_return_stop_after(sopt, lopt) \
-	if (id == xap_derive_id(sopt, lopt)) return true;
+#define xap_define_table_layered_parser(name, struct_type, table) \
+	xap_declare_layered_parser(name, struct_type) \
+	{ \
+		return xap_table_parse_layered(table(), layers, argc, argv, args); \
+	}
+#endif
 
-#define xap_define_parser(name, struct_type, arguments, stop_after, required) \
-	bool xap_get_stop_after_ ## name(int id) \
+#define xap_define_table_fprint_usage(name, table) \
+	xap_declare_fprint_usage(name) \
 	{ \
-		stop_after(xap_derive_return_stop_after) \
-		return false; \
-	} \
-	xap_declare_parser(name, struct_type) \
+		return xap_table_fprint_usage(table(), stream); \
+	}
+
+#define xap_define_table_fprint_help(name, table) \
+	xap_declare_fprint_usage(name) \
 	{ \
-		bool (*get_stop_after)(int) = xap_get_stop_after_ ## name; \
-		xap_parser_vars(arguments, stop_after, required); \
-		xap_parser_fsm(arguments, required); \
-		return ctx; \
+		return xap_table_fprint_help(table(), stream); \
 	}
 
-/* usage function */
-#define xap_derive_update_is_required(sopt, lopt) \
-	if (id == xap_derive_id(sopt, lopt)) is_required = true;
+/* shell completion
+ *
+ * xap_table_complete() prints the candidates for argv[word] (an empty word
+ * if word == argc), one per line, without converting anything: the words
+ * before it are only looked up to see whether argv[word] is the value of a
+ * keyword or which position it is at; short options come from sopt_states
+ * and long options from the sorted lopt_index, both in order, and values
+ * from display names that separate them with '|' (see xap_choice_names)
+ *
+ * the same information can also be written out once as a bash or zsh script,
+ * so that the shell does not have to run the program on every keystroke
+ */
+/* the choices in the display name of state, or NULL if it does not list any */
+static inline
+char const * xap_table_choices(xap_table_t const * table, size_t state)
+{
+	xap_hint_t const * hint = xap_table_hint(table, table->options[state].id);
+	return hint != NULL && hint->disp != NULL && strchr(hint->disp, '|') != NULL ? hint->disp : NULL;
+}
 
-#define xap_derive_update_display_name(sopt, lopt, disp, desc) \
-	if (id == xap_derive_id(sopt, lopt) && disp != NULL) display_name = disp;
+static inline
+int xap_complete_choices(char const * choices, char const * lead, size_t lead_len, char const * prefix, FILE * stream)
+{
+	if (choices == NULL) return 0;
+	size_t len = strlen(prefix);
+	int n = 0;
+	for (;;) {
+		size_t choice_len = strcspn(choices, "|");
+		if (choice_len >= len && strncmp(choices, prefix, len) == 0) {
+			fprintf(stream, "%.*s%.*s\n", (int)lead_len, lead, (int)choice_len, choices);
+			n++;
+		}
+		if (choices[choice_len] == '\0') return n;
+		choices += choice_len + 1;
+	}
+}
 
-#define xap_derive_argument_usage_print_lopt(sopt, lopt, type, name, arry, conv) \
-	cnt += lopt \
-		? fprintf(stream, is_required ? " --%s%s%s" : " [--%s%s%s]", (char *)lopt, space, display_name) \
-		: fprintf(stream, is_required ? " %s"       : " [%s]"                           , display_name);
-#define xap_derive_argument_usage_print_sopt(sopt, lopt, type, name, arry, conv) \
-	cnt += lopt \
-		? fprintf(stream, is_required ? " -%c%s%s" : " [-%c%s%s]", sopt, space, display_name) \
-		: fprintf(stream, is_required ? " %s"       : " [%s]"                 , display_name);
+/* long options that start with prefix[0:len], in order */
+static inline
+int xap_complete_lopts(xap_table_t const * table, char const * prefix, size_t len, FILE * stream)
+{
+	int n = 0;
+	if (!xap_lopt_ready(table->lopt_index, table->lopt_names, table->n_states)) {
+		for (size_t state = 1; state < table->n_states; state++) {
+			char const * lopt = table->lopt_names[state];
+			if (lopt == NULL || lopt[0] == '\0' || strncmp(lopt, prefix, len) != 0) continue;
+			fprintf(stream, "--%s\n", lopt);
+			n++;
+		}
+		return n;
+	}
+	xap_lopt_index_t const * index = table->lopt_index;
+	size_t lo = 0, hi = index->n;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (strncmp(table->lopt_names[index->sorted[mid]], prefix, len) < 0) lo = mid + 1;
+		else hi = mid;
+	}
+	for (; lo < index->n && strncmp(table->lopt_names[index->sorted[lo]], prefix, len) == 0; lo++) {
+		fprintf(stream, "--%s\n", table->lopt_names[index->sorted[lo]]);
+		n++;
+	}
+	return n;
+}
 
-#define xap_derive_argument_usage_print xap_derive_argument_usage_print_lopt
+/* returns the number of candidates */
+static inline
+int xap_table_complete(xap_table_t const * table, int argc, char ** argv, int word, FILE * stream)
+{
+	size_t pending = 0; /* a keyword still waiting for its value */
+	int position = 0;
+	for (int i = 0; i < word && i < argc; i++) {
+		char const * arg = argv[i];
+		if (pending) {
+			pending = 0;
+			continue;
+		}
+		if (arg[0] != '-' || arg[1] == '\0') {
+			size_t state = xap_table_position(table, position++);
+			if (state && table->options[state].rest) return 0;
+			continue;
+		}
+		if (arg[1] == '-' && arg[2] == '\0') return 0;
+		if (arg[1] == '-') {
+			size_t len = xap_lopt_length(arg + 2);
+			int state = xap_find_lopt(table->lopt_index, table->lopt_names, table->n_states, arg + 2, len, table->abbreviate);
+			if (state > 0 && table->options[state].rest) return 0;
+			if (state > 0 && arg[2 + len] == '\0' && xap_table_takes_value(table, state)) pending = state;
+			continue;
+		}
+		for (char const * c = arg + 1; c[0] != '\0'; c++) {
+			size_t state = table->sopt_states[(unsigned char)c[0]];
+			if (state == 0) break;
+			if (table->options[state].rest) return 0;
+			if (!xap_table_takes_value(table, state)) continue;
+			if (c[1] == '\0') pending = state;
+			break;
+		}
+	}
 
-#define xap_derive_argument_usage(sopt, lopt, type, name, arry, conv) \
-	id = xap_derive_id(sopt, lopt); \
-	is_required = false; \
-	for (int i = 0; !is_required && i < n_required_ids; i++) \
-		is_required = required_ids[i] == id; \
-	display_name = get_name(id); \
-	if (display_name == NULL) display_name = #name #arry; \
-	space = display_name[0] == '\0' ? "" : " "; \
-	xap_derive_argument_usage_print(sopt, lopt, type, name, arry, conv)
+	char const * prefix = word < argc ? argv[word] : "";
+	if (pending) return xap_complete_choices(xap_table_choices(table, pending), "", 0, prefix, stream);
+	if (prefix[0] == '-' && prefix[1] == '-') {
+		size_t len = xap_lopt_length(prefix + 2);
+		if (prefix[2 + len] != '=') return xap_complete_lopts(table, prefix + 2, len, stream);
+		int state = xap_find_lopt(table->lopt_index, table->lopt_names, table->n_states, prefix + 2, len, table->abbreviate);
+		if (state <= 0 || !xap_table_takes_value(table, state)) return 0;
+		return xap_complete_choices(xap_table_choices(table, state), prefix, len + 3, prefix + len + 3, stream);
+	}
+	if (prefix[0] == '-' && prefix[1] == '\0') {
+		int n = 0;
+		for (int c = 1; c < 256; c++) {
+			if (table->sopt_states[c] == 0) continue;
+			fprintf(stream, "-%c\n", c);
+			n++;
+		}
+		return n + xap_complete_lopts(table, "", 0, stream);
+	}
+	if (prefix[0] == '-') {
+		/* a cluster is complete as it is if every option in it is known */
+		for (char const * c = prefix + 1; c[0] != '\0'; c++) {
+			size_t state = table->sopt_states[(unsigned char)c[0]];
+			if (state == 0) return 0;
+			if (xap_table_takes_value(table, state)) break;
+		}
+		fprintf(stream, "%s\n", prefix);
+		return 1;
+	}
+	size_t state = xap_table_position(table, position);
+	return state ? xap_complete_choices(xap_table_choices(table, state), "", 0, prefix, stream) : 0;
+}
 
-#define xap_declare_fprint_usage(name) \
-	int name(FILE * stream)
+/* s[0:len] for a single-quoted shell word, with a backslash before any of
+ * escape */
+static inline
+int xap_fputs_quoted(char const * s, size_t len, char const * escape, FILE * stream)
+{
+	int cnt = 0;
+	for (size_t k = 0; k < len; k++) {
+		if (s[k] == '\'') cnt += fputs("'\\''", stream);
+		else {
+			if (s[k] != '\0' && strchr(escape, s[k]) != NULL) cnt += fputc('\\', stream) != EOF;
+			cnt += fputc(s[k], stream) != EOF;
+		}
+	}
+	return cnt;
+}
 
-#define xap_derive_return_name(sopt, lopt, disp, desc) \
-	if (id == xap_derive_id(sopt, lopt)) return disp;
+/* _xap_ followed by program with anything but letters and digits replaced */
+static inline
+int xap_fprint_completion_function(char const * program, FILE * stream)
+{
+	int cnt = fputs("_xap_", stream);
+	for (; program[0] != '\0'; program++) {
+		char c = program[0];
+		bool alnum = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9');
+		cnt += fputc(alnum ? c : '_', stream) != EOF;
+	}
+	return cnt;
+}
 
-#define xap_define_fprint_usage(name, arguments, required, display_hints) \
-	char * xap_get_name_ ## name(int id) \
-	{ \
-		display_hints(xap_derive_return_name) \
-		return NULL; \
-	} \
-	\
-	xap_declare_fprint_usage(name) \
-	{ \
-		char * (*get_name)(int) = xap_get_name_ ## name; \
-		const int n_required_ids = xap_count(required); \
-		const int required_ids[xap_count(required)] = xap_ids(required); \
-		bool is_required; \
-		int cnt = 0, id; \
-		char * display_name, * space; \
-		cnt += fprintf(stream, "usage:"); \
-		arguments(xap_derive_argument_usage); \
-		cnt += fputc('\n', stream) != EOF; \
-		return cnt; \
+/* the quoted names of state for a case pattern or a word list */
+static inline
+int xap_fprint_bash_names(xap_table_t const * table, size_t state, char const * separator, FILE * stream)
+{
+	xap_option_t const * option = table->options + state;
+	char sopt = option->id;
+	int cnt = 0;
+	if (xap_has_sopt(option->id)) {
+		cnt += fputs("'-", stream);
+		cnt += xap_fputs_quoted(&sopt, 1, "", stream);
+		cnt += fputc('\'', stream) != EOF;
 	}
+	else separator = "";
+	if (option->lopt[0] != '\0') {
+		cnt += fprintf(stream, "%s'--", separator);
+		cnt += xap_fputs_quoted(option->lopt, strlen(option->lopt), "", stream);
+		cnt += fputc('\'', stream) != EOF;
+	}
+	return cnt;
+}
 
-/* help function */
-#define xap_derive_fprint_positional_help(sopt, lopt, type, name, arry, conv) \
-	if (!lopt) { \
-		int id = xap_derive_id(sopt, lopt); \
-		char * desc = get_desc(id); \
-		if (desc != NULL && desc[0] != '\0') { \
-			char * disp = get_disp(id); \
-			cnt += fprintf(stream, "  %-20s %s\n", disp, desc); \
-		} \
-	};
+static inline
+int xap_fprint_bash_choices(char const * choices, FILE * stream)
+{
+	int cnt = 0;
+	for (;;) {
+		size_t len = strcspn(choices, "|");
+		cnt += fputs(" '", stream);
+		cnt += xap_fputs_quoted(choices, len, "", stream);
+		cnt += fputc('\'', stream) != EOF;
+		if (choices[len] == '\0') return cnt;
+		choices += len + 1;
+	}
+}
 
-#define xap_derive_fprint_keyword_help(sopt, lopt, type, name, arry, conv) \
-	if (lopt) { \
-		int id = xap_derive_id(sopt, lopt); \
-		char * desc = get_desc(id); \
-		if (desc != NULL && desc[0] != '\0') { \
-			char * disp = get_disp(id); \
-			int n = 0; \
-			n += fprintf(stream, "  -%c", sopt); \
-			if (((char *)lopt)[0] != '\0') \
-				n += fprintf(stream, ", --%s  ", (char *)lopt); \
-			else \
-				n += fputs("  ", stream); \
-			if (disp) \
-				n += fprintf(stream, "%s", disp); \
-			cnt += n; \
-			cnt += n >= 23 ? fprintf(stream, "\n%*.*s", 23, 23, "") : fprintf(stream, "%*.*s", 23 - n, 23 - n, ""); \
-			cnt += fprintf(stream, "%s\n", desc); \
-		} \
-	};
+static inline
+int xap_table_fprint_bash_completion(xap_table_t const * table, char const * program, FILE * stream)
+{
+	int cnt = 0, rest_position = 0;
+	cnt += fprintf(stream, "# bash completion for %s\n", program);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs("_add()\n{\n\tlocal word\n\tfor word; do [[ $word == \"$cur\"* ]] && COMPREPLY+=(\"$word\"); done\n}\n\n", stream);
+	/* opt is set to -x if x in the cluster $1 takes the next word as its value */
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs("_cluster()\n{\n\tlocal k c values='", stream);
+	for (int c = 1; c < 256; c++) {
+		size_t state = table->sopt_states[c];
+		if (state == 0 || !(table->options[state].rest || xap_table_takes_value(table, state))) continue;
+		char sopt = c;
+		cnt += xap_fputs_quoted(&sopt, 1, "", stream);
+	}
+	cnt += fputs("'\n\topt=\n"
+		"\tfor ((k = 1; k < ${#1}; k++)); do\n"
+		"\t\tc=${1:k:1}\n"
+		"\t\tif [[ $values == *\"$c\"* ]]; then\n"
+		"\t\t\t((k == ${#1} - 1)) && opt=-$c\n"
+		"\t\t\treturn\n"
+		"\t\tfi\n"
+		"\tdone\n}\n\n", stream);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs("()\n{\n"
+		"\tlocal cur=${COMP_WORDS[COMP_CWORD]} prev= i word opt position=1\n"
+		"\tCOMPREPLY=()\n"
+		"\t((COMP_CWORD > 0)) && prev=${COMP_WORDS[COMP_CWORD-1]}\n"
+		"\tif [[ $cur == = ]]; then\n"
+		"\t\tcur=\n"
+		"\telif [[ $prev == = ]] && ((COMP_CWORD > 1)); then\n"
+		"\t\tprev=${COMP_WORDS[COMP_CWORD-2]}\n"
+		"\tfi\n"
+		"\tfor ((i = 1; i < COMP_CWORD; i++)); do\n"
+		"\t\tword=${COMP_WORDS[i]}\n"
+		"\t\tif [[ $word == -[!-]?* ]]; then\n"
+		"\t\t\t", stream);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs("_cluster \"$word\"\n"
+		"\t\t\t[[ $opt ]] || continue\n"
+		"\t\t\tword=$opt\n"
+		"\t\tfi\n"
+		"\t\tcase $word in\n"
+		"\t\t\t--) return;;\n", stream);
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		if (!option->lopt) {
+			if (option->rest && (rest_position == 0 || -option->id < rest_position)) rest_position = -option->id;
+			continue;
+		}
+		if (!option->rest && !xap_table_takes_value(table, state)) continue;
+		cnt += fputs("\t\t\t", stream);
+		cnt += xap_fprint_bash_names(table, state, "|", stream);
+		cnt += fputs(option->rest ? ") return;;\n" : ")\n\t\t\t\t[[ ${COMP_WORDS[i+1]} == = ]] && ((i++))\n\t\t\t\t((i++));;\n", stream);
+	}
+	cnt += fputs("\t\t\t-?*) ;;\n\t\t\t*) ((position++));;\n\t\tesac\n\tdone\n", stream);
+	if (rest_position) cnt += fprintf(stream, "\t((position > %d)) && return\n", rest_position);
 
+	cnt += fputs("\tif [[ $prev == -[!-]?* ]]; then\n\t\t", stream);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs("_cluster \"$prev\"\n\t\tprev=$opt\n\tfi\n", stream);
+	cnt += fputs("\tcase $prev in\n", stream);
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		if (!option->lopt || option->rest || !xap_table_takes_value(table, state)) continue;
+		char const * choices = xap_table_choices(table, state);
+		cnt += fputs("\t\t", stream);
+		cnt += xap_fprint_bash_names(table, state, "|", stream);
+		cnt += fputs(") ", stream);
+		if (choices != NULL) {
+			cnt += xap_fprint_completion_function(program, stream);
+			cnt += fputs("_add", stream);
+			cnt += xap_fprint_bash_choices(choices, stream);
+			cnt += fputs("; ", stream);
+		}
+		cnt += fputs("return;;\n", stream);
+	}
+	cnt += fputs("\tesac\n\tif [[ $cur == -* ]]; then\n\t\t", stream);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs("_add", stream);
+	for (int c = 1; c < 256; c++) {
+		if (table->sopt_states[c] == 0) continue;
+		cnt += fputc(' ', stream) != EOF;
+		cnt += xap_fprint_bash_names(table, table->sopt_states[c], " ", stream);
+	}
+	for (size_t state = 1; state < table->n_states; state++) {
+		if (!table->options[state].lopt || xap_has_sopt(table->options[state].id)) continue;
+		cnt += fputc(' ', stream) != EOF;
+		cnt += xap_fprint_bash_names(table, state, " ", stream);
+	}
+	cnt += fputs("\n\t\treturn\n\tfi\n\tcase $position in\n", stream);
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		char const * choices = xap_table_choices(table, state);
+		if (option->lopt || choices == NULL) continue;
+		cnt += fprintf(stream, "\t\t%d) ", -option->id);
+		cnt += xap_fprint_completion_function(program, stream);
+		cnt += fputs("_add", stream);
+		cnt += xap_fprint_bash_choices(choices, stream);
+		cnt += fputs(";;\n", stream);
+	}
+	cnt += fputs("\tesac\n}\n\ncomplete -o default -F ", stream);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fprintf(stream, " %s\n", program);
+	return cnt;
+}
 
-#define xap_derive_return_desc(sopt, lopt, disp, desc) \
-	if (id == xap_derive_id(sopt, lopt)) return desc;
-#define xap_derive_return_disp(sopt, lopt, disp, desc) \
-	if (id == xap_derive_id(sopt, lopt)) return disp;
+/* the rest of an _arguments spec after the option names: [desc]:message:action */
+static inline
+int xap_fprint_zsh_spec(xap_table_t const * table, size_t state, FILE * stream)
+{
+	xap_option_t const * option = table->options + state;
+	xap_hint_t const * hint = xap_table_hint(table, option->id);
+	char const * desc = hint != NULL ? hint->desc : NULL;
+	char const * choices = xap_table_choices(table, state);
+	char const * message = hint != NULL && hint->disp != NULL && hint->disp[0] != '\0' && choices == NULL ? hint->disp : option->name;
+	if (!option->lopt && desc != NULL && desc[0] != '\0') message = desc;
+	int cnt = 0;
+	if (option->lopt && desc != NULL && desc[0] != '\0') {
+		cnt += fputc('[', stream) != EOF;
+		cnt += xap_fputs_quoted(desc, strlen(desc), "[]\\", stream);
+		cnt += fputc(']', stream) != EOF;
+	}
+	if (option->lopt && !option->rest && !xap_table_takes_value(table, state)) return cnt;
+	cnt += fputc(':', stream) != EOF;
+	cnt += xap_fputs_quoted(message, strlen(message), ":\\", stream);
+	if (choices == NULL) return cnt + fputs(":_default", stream);
+	cnt += fputs(":(", stream);
+	for (;;) {
+		size_t len = strcspn(choices, "|");
+		cnt += xap_fputs_quoted(choices, len, " ()\\", stream);
+		if (choices[len] == '\0') break;
+		cnt += fputc(' ', stream) != EOF;
+		choices += len + 1;
+	}
+	cnt += fputc(')', stream) != EOF;
+	return cnt;
+}
 
-#define xap_define_fprint_help(name, arguments, display_hints) \
-	char * xap_get_desc_ ## name(int id) \
+static inline
+int xap_table_fprint_zsh_completion(xap_table_t const * table, char const * program, FILE * stream)
+{
+	int cnt = 0;
+	cnt += fprintf(stream, "#compdef %s\n\n", program);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs("()\n{\n\t_arguments -s -S", stream);
+	for (size_t state = 1; state < table->n_states; state++) {
+		xap_option_t const * option = table->options + state;
+		if (!option->lopt) {
+			if (option->id == 0) continue; /* argv[0] */
+			if (option->rest) cnt += fputs(" \\\n\t\t'*", stream);
+			else cnt += fprintf(stream, " \\\n\t\t'%d", -option->id);
+			cnt += xap_fprint_zsh_spec(table, state, stream);
+			cnt += fputc('\'', stream) != EOF;
+			continue;
+		}
+		bool value = option->rest || xap_table_takes_value(table, state);
+		char const * exclude = option->repeatable ? "*" : "";
+		char sopt = option->id;
+		if (xap_has_sopt(option->id)) {
+			cnt += fprintf(stream, " \\\n\t\t'%s-", exclude);
+			cnt += xap_fputs_quoted(&sopt, 1, "[]:", stream);
+			cnt += fprintf(stream, "%s", value ? "+" : "");
+			cnt += xap_fprint_zsh_spec(table, state, stream);
+			cnt += fputc('\'', stream) != EOF;
+		}
+		if (option->lopt[0] == '\0') continue;
+		cnt += fprintf(stream, " \\\n\t\t'%s--", exclude);
+		cnt += xap_fputs_quoted(option->lopt, strlen(option->lopt), "[]:", stream);
+		cnt += fprintf(stream, "%s", value ? "=" : "");
+		cnt += xap_fprint_zsh_spec(table, state, stream);
+		cnt += fputc('\'', stream) != EOF;
+	}
+	cnt += fputs("\n}\n\nif [[ $zsh_eval_context[-1] == loadautofunc ]]; then\n\t", stream);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fputs(" \"$@\"\nelse\n\tcompdef ", stream);
+	cnt += xap_fprint_completion_function(program, stream);
+	cnt += fprintf(stream, " %s\nfi\n", program);
+	return cnt;
+}
+
+#define xap_declare_completion(name) \
+	int name(int argc, char ** argv, int word, FILE * stream)
+
+/* name(argc, argv, word, stream), name_fprint_bash(program, stream) and
+ * name_fprint_zsh(program, stream) on top of a table */
+#define xap_define_table_completion(name, table) \
+	xap_declare_completion(name) \
 	{ \
-		display_hints(xap_derive_return_desc) \
-		return "---"; \
+		return xap_table_complete(table(), argc, argv, word, stream); \
 	} \
 	\
-	char * xap_get_disp_ ## name(int id) \
+	int name ## _fprint_bash(char const * program, FILE * stream) \
 	{ \
-		display_hints(xap_derive_return_disp) \
-		return NULL; \
+		return xap_table_fprint_bash_completion(table(), program, stream); \
 	} \
 	\
-	xap_declare_fprint_usage(name) \
+	int name ## _fprint_zsh(char const * program, FILE * stream) \
 	{ \
-		int cnt = 0; \
-		char * (*get_desc)(int) = xap_get_desc_ ## name; \
-		char * (*get_disp)(int) = xap_get_disp_ ## name; \
-		cnt += fputs("\npositional arguments:\n", stream); \
-		arguments(xap_derive_fprint_positional_help) \
-		cnt += fputs("\nkeyword arguments:\n", stream); \
-		arguments(xap_derive_fprint_keyword_help) \
-		return cnt; \
+		return xap_table_fprint_zsh_completion(table(), program, stream); \
 	}
 
+/* the same for parsers made from the X-macros, through a table of their own */
+#define xap_derive_completion_none(_) _(0, NULL)
+#define xap_define_completion(name, struct_type, arguments, display_hints) \
+	xap_define_table(xap_completion_table_ ## name, struct_type, arguments, xap_derive_completion_none, xap_derive_completion_none, display_hints) \
+	xap_define_table_completion(name, xap_completion_table_ ## name)
+
 #endif/*XARGPARSE_H*/